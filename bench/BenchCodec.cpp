@@ -0,0 +1,102 @@
+// Microbenchmark of hex decoding/encoding kernels.
+// Records of typical sizes are converted one by one, as the HEX loader and writer do.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "../intelhex_codec.h"
+
+using namespace std;
+using Kernel = HexCodec::Kernel;
+
+
+// Hex text of 'count' records with 'data_len' data bytes, without ':' and newlines
+static string make_records(size_t data_len, size_t count)
+{
+	mt19937 rnd(data_len);
+	static const char digits[] = "0123456789ABCDEF";
+	string text;
+	text.reserve((data_len + 5) * 2 * count);
+	for (size_t i = 0; i < (data_len + 5) * count; i++)
+	{
+		const uint8_t b = uint8_t(rnd());
+		text += digits[b >> 4];
+		text += digits[b & 0x0F];
+	}
+	return text;
+}
+
+// Best of several runs, in MB/s of hex text
+static double measure_decode(Kernel kernel, const string & text, size_t record_chars)
+{
+	uint8_t out[260];
+	double best = 0;
+	unsigned check = 0;
+	for (int run = 0; run < 5; run++)
+	{
+		const auto t0 = chrono::steady_clock::now();
+		for (size_t pos = 0; pos + record_chars <= text.size(); pos += record_chars)
+		{
+			uint8_t sum;
+			check += HexCodec::decode(kernel, text.data() + pos, record_chars, out, sum);
+			check += sum;
+		}
+		const chrono::duration<double> dt = chrono::steady_clock::now() - t0;
+		best = max(best, text.size() / dt.count() / 1e6);
+	}
+	if (check == 42)		// keep results alive
+		printf(" ");
+	return best;
+}
+
+static double measure_encode(Kernel kernel, const string & text, size_t record_chars)
+{
+	const size_t record_bytes = record_chars / 2;
+	vector<uint8_t> bin(text.size() / 2);
+	uint8_t sum;
+	HexCodec::decode(Kernel::scalar, text.data(), text.size(), bin.data(), sum);
+
+	char out[520];
+	double best = 0;
+	unsigned check = 0;
+	for (int run = 0; run < 5; run++)
+	{
+		const auto t0 = chrono::steady_clock::now();
+		for (size_t pos = 0; pos + record_bytes <= bin.size(); pos += record_bytes)
+			check += HexCodec::encode(kernel, bin.data() + pos, record_bytes, out) + out[7];
+		const chrono::duration<double> dt = chrono::steady_clock::now() - t0;
+		best = max(best, text.size() / dt.count() / 1e6);
+	}
+	if (check == 42)
+		printf(" ");
+	return best;
+}
+
+
+int main()
+{
+	printf("op,record_bytes,kernel,MB_per_s,speedup\n");
+	for (size_t data_len : { 16, 32, 255 })
+	{
+		const size_t record_chars = (data_len + 5) * 2;
+		const string text = make_records(data_len, (64 << 20) / record_chars);
+		for (bool decode : { true, false })
+		{
+			double scalar = 0;
+			for (auto kernel : { Kernel::scalar, Kernel::sse2, Kernel::avx2 })
+			{
+				if (! HexCodec::supported(kernel))
+					continue;
+				const double mbs = decode ? measure_decode(kernel, text, record_chars)
+										  : measure_encode(kernel, text, record_chars);
+				if (kernel == Kernel::scalar)
+					scalar = mbs;
+				printf("%s,%zu,%s,%.1f,%.2f\n", decode ? "decode" : "encode",
+					   data_len, HexCodec::name(kernel), mbs, mbs / scalar);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,301 @@
+// Benchmark of IntelHex operations on synthetic images.
+// Inputs are generated from fixed seeds, so results of different runs are comparable.
+// Output is CSV, one line per case and operation:
+//   throughput of image data (MB/s) and of HEX records (records/s, for loadhex and write_hex_file),
+//   heap allocations per MB of data and peak RSS of the process so far.
+//
+// Usage: IntelHexBench [max_MB]    cases with images above max_MB are skipped (default 256)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "../intelhex.h"
+#include "../intelhex_record.h"
+
+using namespace std;
+using Addr = IntelHex::Addr;
+
+
+// Every heap allocation of the process is counted
+static atomic<size_t> allocations{ 0 };
+
+void * operator new(size_t size)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+	if (void * p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+void * operator new[](size_t size)
+{	return operator new(size);	}
+void operator delete(void * p) noexcept
+{	free(p);	}
+void operator delete[](void * p) noexcept
+{	free(p);	}
+void operator delete(void * p, size_t) noexcept
+{	free(p);	}
+void operator delete[](void * p, size_t) noexcept
+{	free(p);	}
+
+// storage comes here through std::pmr::new_delete_resource
+void * operator new(size_t size, align_val_t align)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+#if defined(_WIN32)
+	if (void * p = _aligned_malloc(size ? size : 1, size_t(align)))
+		return p;
+#else
+	void * p;
+	if (posix_memalign(&p, max(size_t(align), sizeof(void *)), size ? size : 1) == 0)
+		return p;
+#endif
+	throw bad_alloc();
+}
+void * operator new[](size_t size, align_val_t align)
+{	return operator new(size, align);	}
+void operator delete(void * p, align_val_t) noexcept
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+void operator delete[](void * p, align_val_t align) noexcept
+{	operator delete(p, align);	}
+void operator delete(void * p, size_t, align_val_t align) noexcept
+{	operator delete(p, align);	}
+void operator delete[](void * p, size_t, align_val_t align) noexcept
+{	operator delete(p, align);	}
+
+
+static double peak_rss_mb()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (! GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize / 1e6;
+#else
+	rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#if defined(__APPLE__)
+	return ru.ru_maxrss / 1e6;		// bytes
+#else
+	return ru.ru_maxrss / 1e3;		// kilobytes
+#endif
+#endif
+}
+
+
+struct Case
+{
+	string name;
+	IntelHex image;
+	string hex;				// image as HEX text
+	size_t records = 0;		// number of records in hex
+	uint32_t byte_count = 16;
+};
+
+static size_t count_records(const string & hex)
+{
+	size_t n = 0;
+	for (char c : hex)
+		n += (c == ':');
+	return n;
+}
+
+static Case make_case(string name, IntelHex && image, uint32_t byte_count = 16)
+{
+	Case c;
+	c.name = move(name);
+	c.image = move(image);
+	c.byte_count = byte_count;
+	ostringstream ss;
+	c.image.write_hex_file(ss, true, byte_count);
+	c.hex = ss.str();
+	c.records = count_records(c.hex);
+	return c;
+}
+
+static IntelHex::BinArray random_bytes(size_t size, uint32_t seed)
+{
+	mt19937 rnd(seed);
+	IntelHex::BinArray bin(size);
+	for (auto & b : bin)
+		b = uint8_t(rnd());
+	return bin;
+}
+
+// Contiguous image of size MB
+static IntelHex dense(size_t mb, Addr base = 0x08000000)
+{
+	IntelHex ih;
+	ih.frombytes(random_bytes(mb << 20, uint32_t(mb)), base);
+	return ih;
+}
+
+// Data chunks of random size (1..max_chunk) separated by random gaps (1..max_gap)
+static IntelHex fragmented(size_t data_size, size_t max_chunk, size_t max_gap, uint32_t seed)
+{
+	mt19937 rnd(seed);
+	const auto bin = random_bytes(max_chunk, seed);
+	IntelHex ih;
+	Addr addr = 0x10000000;
+	for (size_t total = 0; total < data_size; )
+	{
+		const size_t len = min<size_t>(rnd() % max_chunk + 1, data_size - total);
+		ih.frombytes(bin.data(), len, addr);
+		addr += Addr(len + rnd() % max_gap + 1);
+		total += len;
+	}
+	return ih;
+}
+
+// The same data as 'image' written with Extended Segment Address Records (02).
+// Image should lie below 1M.
+static Case segmented_case(string name, IntelHex && image)
+{
+	Case c = make_case(move(name), move(image));
+	ostringstream ss;
+	HexRecordWriter writer(ss, 16, HexRecordWriter::Addressing::segmented);
+	for (auto & seg : c.image.segments())
+	{
+		IntelHex::BinArray bin(Addr(seg.end - seg.begin));
+		c.image.tobinbuffer(seg.begin, bin.data(), bin.size());
+		writer.data(seg.begin, bin.data(), bin.size());
+	}
+	writer.finish();
+	c.hex = ss.str();
+	c.records = count_records(c.hex);
+	return c;
+}
+
+
+struct Result
+{
+	double seconds;
+	size_t allocations;
+};
+
+// Best time of several runs; allocations of the last run
+static Result measure(const function<void()> & op, int runs)
+{
+	Result best{ 1e30, 0 };
+	for (int i = 0; i < runs; i++)
+	{
+		const size_t alloc0 = allocations.load();
+		const auto t0 = chrono::steady_clock::now();
+		op();
+		const chrono::duration<double> dt = chrono::steady_clock::now() - t0;
+		best.seconds = min(best.seconds, dt.count());
+		best.allocations = allocations.load() - alloc0;
+	}
+	return best;
+}
+
+static void report(const Case & c, const char * op, const Result & r, size_t records)
+{
+	const double mb = c.image.size() / 1e6;
+	printf("%s,%s,%.3f,%zu,%.6f,%.1f,%.0f,%.1f,%.1f\n",
+		   c.name.c_str(), op, mb, records, r.seconds,
+		   mb / r.seconds, records / r.seconds, r.allocations / mb, peak_rss_mb());
+	fflush(stdout);
+}
+
+static void run_case(const Case & c)
+{
+	const int runs = c.image.size() > (64u << 20) ? 1 : 3;
+	volatile size_t sink = 0;		// keep results alive
+
+	report(c, "loadhex", measure([&] {
+		istringstream ss(c.hex);
+		IntelHex ih;
+		ih.loadhex(ss);
+		sink = sink + ih.size();
+	}, runs), c.records);
+
+	const auto min_addr = *c.image.minaddr();
+	const auto bin = c.image.tobinarray();
+	const string bin_text(bin.begin(), bin.end());
+	report(c, "loadbin", measure([&] {
+		istringstream ss(bin_text);
+		IntelHex ih;
+		ih.loadbin(ss, min_addr);
+		sink = sink + ih.size();
+	}, runs), 0);
+
+	report(c, "write_hex_file", measure([&] {
+		ostringstream ss;
+		c.image.write_hex_file(ss, true, c.byte_count);
+		sink = sink + size_t(ss.tellp());
+	}, runs), c.records);
+
+	report(c, "tobinarray", measure([&] {
+		sink = sink + c.image.tobinarray().size();
+	}, runs), 0);
+
+	// image is merged into another one which lies right below it
+	// (or right above, if there is no room below)
+	IntelHex base;
+	const Addr base_addr = min_addr >= 0x1000 ? min_addr - 0x1000 : *c.image.maxaddr() + 1;
+	base.frombytes(IntelHex::BinArray(0x1000, 0xFF), base_addr);
+	report(c, "merge", measure([&] {
+		IntelHex ih(base);
+		ih.merge(c.image);
+		sink = sink + ih.size();
+	}, runs), 0);
+
+	report(c, "segments", measure([&] {
+		sink = sink + c.image.segments().size();
+	}, runs), 0);
+
+	// 4 bytes of output per byte of data
+	if (c.image.size() <= (16u << 20))
+	{
+		report(c, "addresses", measure([&] {
+			sink = sink + c.image.addresses().size();
+		}, runs), 0);
+	}
+}
+
+
+int main(int argc, char ** argv)
+{
+	const size_t max_mb = argc > 1 ? strtoul(argv[1], nullptr, 0) : 256;
+
+	printf("case,op,data_MB,records,seconds,MB_per_s,records_per_s,allocs_per_MB,peak_rss_MB\n");
+
+	// image size in MB, generator
+	const vector<pair<size_t, function<Case()>>> cases = {
+		{ 1, [] { return make_case("dense_1M", dense(1)); } },
+		{ 1, [] { return make_case("dense_1M_rec255", dense(1), 255); } },
+		// 02 vs 04 address records for the same data below 1M
+		{ 1, [] { return make_case("low_1M_addr04", dense(1, 0)); } },
+		{ 1, [] { return segmented_case("low_1M_addr02", dense(1, 0)); } },
+		{ 16, [] { return make_case("dense_16M", dense(16)); } },
+		{ 16, [] { return make_case("dense_16M_rec255", dense(16), 255); } },
+		{ 4, [] { return make_case("fragmented_4M", fragmented(4 << 20, 256, 64, 1)); } },
+		{ 2, [] { return make_case("small_segments_100k", fragmented(100000 * 16, 16, 16, 2)); } },
+		{ 256, [] { return make_case("dense_256M", dense(256)); } },
+	};
+
+	for (auto & c : cases)
+		if (c.first <= max_mb)
+			run_case(c.second());
+	return 0;
+}
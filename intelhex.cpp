@@ -1,8 +1,19 @@
 #include "intelhex.h"
 #include "intelhex_exception.h"
+#include "intelhex_io.h"
+#include "intelhex_record.h"
+#include "intelhex_snapshot.h"
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <system_error>
+#include <thread>
 
 using namespace std;
 
@@ -14,146 +25,662 @@ using namespace std;
 
 
 
-// Decode one record of HEX file.
-// @param  s       line with HEX record.
-// @param  line    line number (for error messages).
-// @return false   if EOF record encountered.
-bool IntelHex::decode_record(std::string s, uint32_t line)
+namespace {
+
+// Value of start address record (03 or 05)
+IntelHex::StartAddr start_address(const HexRecord &rec)
 {
-	if (s.back() == '\n') s.pop_back();
-	if (s.back() == '\r') s.pop_back();
+	const uint8_t * bin = rec.data;
+	if (rec.type == 3)
+	{
+		// Start Segment Address Record
+		IntelHex::StartAddrSegmented addr;
+		addr.CS = uint16_t(bin[0]*256 + bin[1]);
+		addr.IP = uint16_t(bin[2]*256 + bin[3]);
+		return addr;
+	}
+	// Start Linear Address Record
+	IntelHex::StartAddrExtended addr = {
+		uint32_t(bin[0]*0x1000000u +
+				 bin[1]*0x10000u +
+				 bin[2]*0x100u +
+				 bin[3]) };
+	return addr;
+}
 
-	if (s.empty()) return true;
+}
 
+// Apply decoded record to the object.
+// Address records are already handled by HexRecordReader.
+// Errors are returned without line number, caller knows it.
+HexResult IntelHex::apply_record(const HexRecord &rec)
+{
+	HexResult res;
 
-	if (s[0] != ':')
-		throw HexRecordError(line);
+	if (rec.type == 0)
+	{
+		// data record
+		if (auto used = buf.find_used(rec.address, rec.length))
+		{
+			res.error = HexError::address_overlap;
+			res.address = used.value();
+			return res;
+		}
+		return store(rec.address, rec.data, rec.length);
+	}
+	else if (rec.type == 3 || rec.type == 5)
+	{
+		if (start_addr.has_value())
+			res.error = HexError::duplicate_start_address;
+		else
+			start_addr = start_address(rec);
+	}
+	// end of file record (1) is not handled, following records are loaded too
+	return res;
+}
 
-	std::vector<uint8_t> bin;
+// Write loaded data. Allocation refused by memory hook stops loading:
+// the image is cleared, so its memory is returned at once.
+HexResult IntelHex::store(Addr addr, const uint8_t *data, size_t len)
+{
+	HexResult res;
 	try {
-		bin = unhexlify(s.substr(1));
+		buf.write(addr, data, len);
 	}
-	catch(...) {
-		// this might be raised by unhexlify when odd hexascii digits
-		throw  HexRecordError(line);
+	catch (const MemoryLimitError &)
+	{
+		buf.clear();
+		res.error = HexError::memory_limit;
+		res.address = addr;
 	}
-	uint32_t length = bin.size();
-	if (length < 5)
-		throw HexRecordError(line);
+	return res;
+}
 
-	const uint8_t record_length = bin[0];
-	if (length != (5u + record_length))
-		throw RecordLengthError(line);
+// Peak of memory_stats() is counted from the start of every load
+void IntelHex::reset_memory_peak()
+{
+	if (MemoryAccount * account = buf.memory_account())
+		account->reset_peak();
+}
+
+IntelHex::MemoryStats IntelHex::memory_stats() const
+{
+	MemoryStats stats;
+	stats.payload = buf.size();
+	if (const MemoryAccount * account = buf.memory_account())
+	{
+		stats.allocated = account->allocated();
+		stats.peak = account->peak_allocated();
+	}
+	stats.overhead = stats.allocated > stats.payload ? stats.allocated - stats.payload : 0;
+	stats.blocks = buf.block_count();
+	stats.segments = buf.segment_count();
+	return stats;
+}
 
-	Addr addr = bin[1]*256 + bin[2];
+void IntelHex::set_memory_hook(std::shared_ptr<MemoryHook> hook)
+{
+	move_storage(make_shared<MemoryAccount>(std::move(hook), memory_resource()));
+}
 
-	const uint8_t record_type = bin[3];
-	if (record_type > 5)
-		throw RecordTypeError(line);
+void IntelHex::set_memory_resource(std::pmr::memory_resource *resource)
+{
+	const MemoryAccount * account = buf.memory_account();
+	move_storage(make_shared<MemoryAccount>(account ? account->memory_hook() : nullptr, resource));
+}
 
-	uint8_t crc = 0;
-	for (auto d : bin) crc += d;
-	if (crc != 0)
-		throw RecordChecksumError(line);
+std::pmr::memory_resource * IntelHex::memory_resource() const
+{
+	const MemoryAccount * account = buf.memory_account();
+	return account ? account->resource() : std::pmr::get_default_resource();
+}
 
-	if (record_type == 0)
+// Copy data to storage with another account
+void IntelHex::move_storage(std::shared_ptr<MemoryAccount> account)
+{
+	Storage moved(std::move(account));
+	buf.for_each_run([&moved](Addr addr, const uint8_t * data, size_t len)
+	{	moved.write(addr, data, len);	});
+	buf = std::move(moved);
+}
+
+
+void IntelHex::loadhex(istream &file)
+{
+	const HexResult res = try_loadhex(file);
+	if (! res.ok())
+		throw_hex_error(res);
+}
+
+HexResult IntelHex::try_loadhex(istream &file)
+{
+	reset_memory_peak();
+	HexRecordReader reader;
+	HexResult res;
+	// plain std::string: only it has the fast getline, the buffer is reused anyway
+	for (string s; getline(file, s); )
 	{
-		// data record
-		addr += offset;
-		for (uint32_t i = 4; i < 4u + record_length; i++)
+		if (const HexRecord * rec = reader.try_next(s, res.error))
+			res = apply_record(*rec);
+		if (! res.ok())
+		{
+			res.line = reader.line();
+			res.offset = reader.line_offset();
+			return res;
+		}
+	}
+	if (file.bad())
+		res.error = HexError::io;
+	return res;
+}
+
+HexResult IntelHex::try_loadhex(const string &fileName)
+{
+	ifstream file(fileName, ios::binary);
+	if (! file)
+	{
+		HexResult res;
+		res.error = HexError::io;
+		return res;
+	}
+	return try_loadhex(file);
+}
+
+vector<HexDiagnostic> IntelHex::loadhex_lenient(istream &file, LenientPolicy policy)
+{
+	reset_memory_peak();
+	vector<HexDiagnostic> diags;
+	HexRecordReader reader;
+	bool stop = false;		// memory limit, image is cleared
+
+	auto apply = [&](const HexRecord & rec, std::string_view s)
+	{
+		HexResult res = apply_record(rec);
+		if (res.ok())
+			return;
+		diags.push_back(HexRecordReader::diagnose(s, rec.line, res.error));
+		diags.back().address = res.address;
+		if (res.error == HexError::memory_limit)
+			stop = true;
+		if (policy != LenientPolicy::apply || stop)
+			return;
+		if (res.error == HexError::address_overlap)
+		{
+			res = store(rec.address, rec.data, rec.length);
+			if (! res.ok())
+			{
+				diags.push_back(HexRecordReader::diagnose(s, rec.line, res.error));
+				diags.back().address = res.address;
+				stop = true;
+			}
+		}
+		else if (res.error == HexError::duplicate_start_address)
+		{
+			start_addr.reset();
+			apply_record(rec);
+		}
+	};
+
+	HexError error;
+	for (string s; getline(file, s); )
+	{
+		if (const HexRecord * rec = reader.try_next(s, error))
+			apply(*rec, s);
+		else if (error != HexError::ok)
+		{
+			diags.push_back(HexRecordReader::diagnose(s, reader.line(), error));
+
+			// bad checksum is the only problem, so the record is usable
+			uint8_t bin[260];
+			HexRecord bad;
+			if (policy == LenientPolicy::apply && error == HexError::record_checksum
+				&& HexRecordReader::parse(s, reader.line(), bin, bad, error, false))
+			{
+				reader.locate(bad);
+				apply(bad, s);
+			}
+		}
+		if (stop)
+			break;
+	}
+	return diags;
+}
+
+namespace {
+
+// Checks of validate(): the same as apply_record(), but only ranges of data are kept
+class Validator
+{
+public:
+	IntelHex::Summary summary;
+
+	// @return false   on error
+	template <typename Lines>
+	bool check(Lines & lines)
+	{
+		HexRecordReader reader;
+		HexResult & res = summary.result;
+		for (std::string_view s; lines(s); )
 		{
-			if (buf.find(addr) != buf.end())
-				throw AddressOverlapError(addr, line);
-			buf[addr] = bin[i];
-			addr += 1;	// FIXME: addr should be wrapped
-						// BUT after 02 record (at 64K boundary)
-						// and after 04 record (at 4G boundary)
+			const HexRecord * rec = reader.try_next(s, res.error);
+			if (rec)
+				res = record(*rec);
+			if (! res.ok())
+			{
+				res.line = reader.line();
+				res.offset = reader.line_offset();
+				return false;
+			}
 		}
+		return true;
 	}
-	else if (record_type == 1)
+
+	IntelHex::Summary finish()
 	{
-		// end of file record
-		if (record_length != 0)
-			throw EOFRecordError(line);
-		return false;	// EOF
+		ranges.for_each([this](IntelHex::Addr first, IntelHex::Addr last)
+		{	summary.segments.push_back({ first, IntelHex::Addr(last + 1) });	});
+		return std::move(summary);
 	}
-	else if (record_type == 2)
+
+private:
+	SegmentIndex ranges;
+
+	HexResult record(const HexRecord & rec);
+};
+
+}
+
+HexResult Validator::record(const HexRecord &rec)
+{
+	HexResult res;
+	if (rec.type == 0)
 	{
-		// Extended 8086 Segment Record
-		if (record_length != 2 || addr != 0)
-			throw ExtendedSegmentAddressRecordError(line);
-		offset = (bin[4]*256 + bin[5]) * 16;
+		if (auto used = ranges.find_used(rec.address, rec.length))
+		{
+			res.error = HexError::address_overlap;
+			res.address = used.value();
+			return res;
+		}
+		ranges.add(rec.address, rec.length);
+		summary.data_records++;
+		summary.data_bytes += rec.length;
 	}
-	else if (record_type == 4)
+	else if (rec.type == 3 || rec.type == 5)
 	{
-		// Extended Linear Address Record
-		if (record_length != 2 || addr != 0)
-			throw ExtendedLinearAddressRecordError(line);
-		offset = (bin[4]*256 + bin[5]) * 65536;
+		if (summary.start_addr.has_value())
+			res.error = HexError::duplicate_start_address;
+		else
+			summary.start_addr = start_address(rec);
 	}
-	else if (record_type == 3)
+	return res;
+}
+
+IntelHex::Summary IntelHex::validate(istream &file)
+{
+	Validator v;
+	string line;
+	auto lines = [&](std::string_view & s)
 	{
-		// Start Segment Address Record
-		if (record_length != 4 || addr != 0)
-			throw StartSegmentAddressRecordError(line);
-		if (start_addr.has_value())
-			throw DuplicateStartAddressRecordError(line);
-		StartAddrSegmented addr;
-		addr.CS = uint16_t(bin[4]*256 + bin[5]);
-		addr.IP = uint16_t(bin[6]*256 + bin[7]);
-		start_addr = addr;
+		if (! getline(file, line))
+			return false;
+		s = line;
+		return true;
+	};
+	if (v.check(lines) && file.bad())
+		v.summary.result.error = HexError::io;
+	return v.finish();
+}
+
+IntelHex::Summary IntelHex::validate(const string &fileName)
+{
+	Validator v;
+	try {
+		MappedFile file(fileName);
+		std::string_view text = file.view();
+		auto lines = [&](std::string_view & s)
+		{
+			if (text.empty())
+				return false;
+			const auto eol = text.find('\n');
+			s = text.substr(0, eol);
+			text.remove_prefix(eol == text.npos ? text.size() : eol + 1);
+			return true;
+		};
+		v.check(lines);
 	}
-	else if (record_type == 5)
+	catch (const system_error &)
 	{
-		// Start Linear Address Record
-		if (record_length != 4 || addr != 0)
-			throw StartLinearAddressRecordError(line);
-		if (start_addr.has_value())
-			throw DuplicateStartAddressRecordError(line);
-		StartAddrExtended addr = {
-			uint32_t(bin[4]*0x1000000 +
-					 bin[5]*0x10000 +
-					 bin[6]*0x100 +
-					 bin[7]) };
-		start_addr = addr;
+		v.summary.result.error = HexError::io;
 	}
-	return true;
+	return v.finish();
 }
 
-void IntelHex::loadhex(istream &file)
+void IntelHex::loadhex_mmap(const string &fileName, unsigned threads)
 {
-	offset = 0;
-	uint32_t line = 0;
+	MappedFile file(fileName);
+	const HexResult res = loadhex_text(file.view(), threads);
+	if (! res.ok())
+		throw_hex_error(res);
+}
 
-	for (string s; getline(file, s); )
+HexResult IntelHex::try_loadhex_mmap(const string &fileName, unsigned threads)
+{
+	try {
+		MappedFile file(fileName);
+		return loadhex_text(file.view(), threads);
+	}
+	catch (const system_error &)
 	{
-		line++;
-//		try {
-			decode_record(s, line);
-//		}
-//		catch (_EndOfFile) {
-//			// pass
-//		}
+		HexResult res;
+		res.error = HexError::io;
+		return res;
 	}
 }
 
-void IntelHex::loadbin(std::istream &file, Addr offset)
+// Load file for load_many(): small files are read into thread's scratch buffer,
+// big ones are memory-mapped.
+HexResult IntelHex::loadhex_file(const string &fileName, vector<char> &scratch)
+{
+	const std::streamoff max_scratch = 1024 * 1024;
+	ifstream file(fileName, ios::binary | ios::ate);
+	const std::streamoff size = file ? std::streamoff(file.tellg()) : -1;
+	if (size >= 0 && size <= max_scratch)
+	{
+		scratch.resize(size_t(size));
+		file.seekg(0);
+		if (! file.read(scratch.data(), size))
+		{
+			HexResult res;
+			res.error = HexError::io;
+			return res;
+		}
+		return loadhex_text(string_view(scratch.data(), scratch.size()));
+	}
+	return try_loadhex_mmap(fileName, 1);
+}
+
+vector<IntelHex::LoadResult> IntelHex::load_many(const vector<string> &fileNames, unsigned threads)
+{
+	vector<LoadResult> results(fileNames.size());
+	if (threads == 0)
+		threads = max(1u, thread::hardware_concurrency());
+	threads = unsigned(min<size_t>(threads, fileNames.size()));
+
+	// files are handed out one by one: fast threads take more of them
+	std::atomic<size_t> next_file{0};
+	std::exception_ptr error;		// unexpected error, e.g. bad_alloc
+	std::mutex error_lock;
+	auto worker = [&]()
+	{
+		vector<char> scratch;
+		try {
+			for (size_t i; (i = next_file++) < fileNames.size(); )
+				results[i].result = results[i].image.loadhex_file(fileNames[i], scratch);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(error_lock);
+			if (! error)
+				error = std::current_exception();
+			next_file = fileNames.size();		// stop other threads
+		}
+	};
+
+	vector<thread> workers;
+	for (unsigned i = 1; i < threads; i++)
+		workers.emplace_back(worker);
+	worker();
+	for (auto & w : workers)
+		w.join();
+	if (error)
+		std::rethrow_exception(error);
+	return results;
+}
+
+// Decode all records of HEX text, line by line.
+// Lines are numbered the same way as with getline().
+HexResult IntelHex::loadhex_text(std::string_view text)
+{
+	reset_memory_peak();
+	HexRecordReader reader;
+	HexResult res;
+	while (! text.empty())
+	{
+		const auto eol = text.find('\n');
+		if (const HexRecord * rec = reader.try_next(text.substr(0, eol), res.error))
+			res = apply_record(*rec);
+		if (! res.ok())
+		{
+			res.line = reader.line();
+			res.offset = reader.line_offset();
+			return res;
+		}
+		if (eol == text.npos)
+			break;
+		text.remove_prefix(eol + 1);
+	}
+	return res;
+}
+
+namespace {
+
+// Part of HEX text (whole lines), decoded by a worker thread
+struct ParsedChunk
+{
+	struct Rec {
+		uint32_t line;
+		uint32_t data;		// offset of record data in payload
+		uint8_t type;
+		uint8_t length;
+		uint16_t addr;
+	};
+
+	std::string_view text;
+	uint32_t first_line = 0;	// number of lines before this chunk
+	uint64_t first_offset = 0;	// offset of the chunk in the text
+	// allocated from the image account (memory hook sees them);
+	// reserved by the loading thread, so workers don't allocate
+	std::vector<Rec, AccountAllocator<Rec>> records;
+	std::vector<uint8_t, AccountAllocator<uint8_t>> payload;
+	HexResult error;			// first error, following lines are not decoded
+
+	explicit ParsedChunk(const AccountAllocator<uint8_t> & alloc)
+		: records(alloc), payload(alloc) {}
+
+	HexRecord record(size_t i) const
+	{
+		const Rec & r = records[i];
+		return { r.type, r.length, r.addr, 0, payload.data() + r.data, r.line };
+	}
+};
+
+// Error of a record in the chunk: find offset of its line.
+// Error path only, so the chunk text is just scanned again.
+HexResult located(HexResult res, const ParsedChunk & chunk, uint32_t line)
+{
+	res.line = line;
+	const char * p = chunk.text.data();
+	for (uint32_t n = chunk.first_line + 1; n < line; n++)
+		p = static_cast<const char *>(memchr(p, '\n', chunk.text.data() + chunk.text.size() - p)) + 1;
+	res.offset = chunk.first_offset + (p - chunk.text.data());
+	return res;
+}
+
+template <typename F>
+void run_parallel(std::vector<ParsedChunk> & chunks, F f)
 {
-	BinArray data((std::istreambuf_iterator<char>(file)),
-				   std::istreambuf_iterator<char>());
-	frombytes(data, offset);
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < chunks.size(); i++)
+		workers.emplace_back(f, std::ref(chunks[i]));
+	f(chunks[0]);
+	for (auto & w : workers)
+		w.join();
 }
 
+}
 
-void IntelHex::frombytes(const BinArray &bytes, Addr offset)
+// Decode HEX text with several threads (0 - all hardware threads).
+// Text is split at line boundaries, chunks are decoded in parallel;
+// then records are applied in file order, so overlaps, address records
+// and errors are handled exactly as in sequential decoding.
+HexResult IntelHex::loadhex_text(std::string_view text, unsigned threads)
 {
-	for (auto b : bytes)
+	if (threads == 0)
+		threads = max(1u, thread::hardware_concurrency());
+	// don't bother with threads for small files
+	const size_t min_chunk = 256 * 1024;
+	threads = unsigned(min<size_t>(threads, text.size() / min_chunk));
+	if (threads <= 1)
+		return loadhex_text(text);
+	reset_memory_peak();
+
+	std::vector<ParsedChunk> chunks;
+	for (size_t pos = 0; pos < text.size(); )
 	{
-		buf[offset] = b;
-		offset++;
+		size_t end = (chunks.size() + 1 == threads) ? text.npos : text.find('\n', pos + text.size() / threads);
+		end = (end == text.npos) ? text.size() : end + 1;
+		chunks.emplace_back(buf.allocator());
+		chunks.back().text = text.substr(pos, end - pos);
+		chunks.back().first_offset = pos;
+		pos = end;
+	}
+
+	// count lines to get line numbers of every chunk
+	std::vector<uint32_t> lines(chunks.size());
+	run_parallel(chunks, [&](ParsedChunk & chunk)
+	{
+		lines[&chunk - chunks.data()] = uint32_t(count(chunk.text.begin(), chunk.text.end(), '\n'));
+	});
+	for (size_t i = 1; i < chunks.size(); i++)
+		chunks[i].first_line = chunks[i - 1].first_line + lines[i - 1];
+	// one record per line at most (the last line may have no newline),
+	// record data takes 2 characters per byte
+	try {
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			chunks[i].records.reserve(lines[i] + 1);
+			chunks[i].payload.reserve(chunks[i].text.size() / 2);
+		}
+	}
+	catch (const MemoryLimitError &)
+	{
+		HexResult res;
+		res.error = HexError::memory_limit;
+		res.line = 1;
+		return res;
+	}
+
+	run_parallel(chunks, [](ParsedChunk & chunk)
+	{
+		uint8_t bin[260];
+		HexRecord rec;
+		HexError error;
+		uint32_t line = chunk.first_line;
+		for (auto t = chunk.text; ! t.empty(); )
+		{
+			line++;
+			const auto eol = t.find('\n');
+			if (HexRecordReader::parse(t.substr(0, eol), line, bin, rec, error))
+			{
+				chunk.records.push_back({ line, uint32_t(chunk.payload.size()), rec.type, rec.length, rec.addr });
+				chunk.payload.insert(chunk.payload.end(), rec.data, rec.data + rec.length);
+			}
+			else if (error != HexError::ok)
+			{
+				chunk.error.error = error;
+				chunk.error.line = line;
+				chunk.error.offset = chunk.first_offset + (t.data() - chunk.text.data());
+				break;
+			}
+			if (eol == t.npos)
+				break;
+			t.remove_prefix(eol + 1);
+		}
+	});
+
+	// apply records in file order
+	HexRecordReader reader;		// follows address records
+	for (auto & chunk : chunks)
+	{
+		const size_t count = chunk.records.size();
+		for (size_t i = 0; i < count; )
+		{
+			HexRecord rec = chunk.record(i);
+			reader.locate(rec);
+			if (rec.type != 0)
+			{
+				HexResult res = apply_record(rec);
+				if (! res.ok())
+					return located(res, chunk, rec.line);
+				i++;
+				continue;
+			}
+
+			// join contiguous data records: one overlap check and one write
+			const Addr begin = rec.address;
+			uint64_t end = uint64_t(begin) + rec.length;
+			size_t last = i + 1;
+			for ( ; last < count; last++)
+			{
+				HexRecord next = chunk.record(last);
+				if (next.type != 0)
+					break;
+				reader.locate(next);
+				if (next.address != end || end + next.length > (1ull << 32))
+					break;
+				end += next.length;
+			}
+
+			if (buf.find_used(begin, end - begin))
+			{
+				// apply records one by one up to the overlapped one
+				for ( ; ; i++)
+				{
+					rec = chunk.record(i);
+					reader.locate(rec);
+					HexResult res = apply_record(rec);
+					if (! res.ok())
+						return located(res, chunk, rec.line);
+				}
+			}
+			const HexResult res = store(begin, rec.data, size_t(end - begin));
+			if (! res.ok())
+				return located(res, chunk, rec.line);
+			i = last;
+		}
+		if (! chunk.error.ok())
+			return chunk.error;
+	}
+	return {};
+}
+
+void IntelHex::loadbin(std::istream &file, Addr offset)
+{
+	reset_memory_peak();
+	// read by big chunks straight into storage
+	std::pmr::vector<char> chunk(256 * 1024, memory_resource());
+	while (file.read(chunk.data(), chunk.size()), file.gcount() > 0)
+	{
+		const size_t got = size_t(file.gcount());
+		frombytes(reinterpret_cast<const uint8_t *>(chunk.data()), got, offset);
+		offset += Addr(got);
 	}
 }
 
+void IntelHex::loadbin(const string &fileName, Addr offset)
+{
+	std::optional<MappedFile> file;
+	try {
+		file.emplace(fileName);
+	}
+	catch (const system_error &)
+	{
+		return;
+	}
+	reset_memory_peak();
+	frombytes(reinterpret_cast<const uint8_t *>(file->data()), file->size(), offset);
+}
+
 
 std::pair<IntelHex::OptionalAddr, IntelHex::OptionalAddr> IntelHex::get_start_end
 	(OptionalAddr start, OptionalAddr end, OptionalAddr size) const
@@ -201,56 +728,85 @@ IntelHex::BinArray IntelHex::tobinarray(OptionalAddr start, OptionalAddr end, Op
 
 	std::tie(start, end)  = get_start_end(start, end, size);
 	if (start.has_value() && end.has_value())
-		for (Addr i = start.value(); i <= end.value(); i++)
-		{
-			bin.push_back(operator[](i));
-		}
+	{
+		bin.resize(size_t(end.value() - start.value()) + 1);
+		tobinbuffer(start.value(), bin.data(), bin.size());
+	}
 	return bin;
 }
 
+void IntelHex::tobinbuffer(Addr start, uint8_t *dst, size_t size) const
+{
+	if (size == 0)
+		return;
+	const Addr last = Addr(min<uint64_t>(uint64_t(start) + size - 1, 0xFFFFFFFF));
+	uint64_t pos = start;	// first address not yet filled
+	buf.for_each_run(start, last, [&](Addr addr, const uint8_t * data, size_t len)
+	{
+		memset(dst + (pos - start), padding, addr - pos);
+		memcpy(dst + (addr - start), data, len);
+		pos = uint64_t(addr) + len;
+	});
+	memset(dst + (pos - start), padding, size - (pos - start));
+}
+
 
 void IntelHex::tobinfile(ostream & file, OptionalAddr start, OptionalAddr end, OptionalAddr size) const
 {
-	auto arr = tobinarray(start, end, size);
-	file.write((const char*) arr.data(), arr.size());
+	if (buf.empty() && !start.has_value() && !end.has_value())
+		return;
+	if (size.has_value() && size.value() <= 0)
+		throw range_error("tobinarray: wrong value for size");
+
+	std::tie(start, end)  = get_start_end(start, end, size);
+	if (! start.has_value() || ! end.has_value())
+		return;
+
+	// write data runs as they are, holes from padding block
+	std::vector<char> pad(4096, char(padding));
+	auto write_padding = [&](uint64_t len)
+	{
+		for ( ; len > 0; len -= min<uint64_t>(len, pad.size()))
+			file.write(pad.data(), min<uint64_t>(len, pad.size()));
+	};
+	// same length as tobinarray: range past 0xFFFFFFFF is padded
+	const uint64_t length = uint64_t(Addr(end.value() - start.value())) + 1;
+	const Addr last = Addr(min<uint64_t>(start.value() + length - 1, 0xFFFFFFFF));
+	uint64_t pos = start.value();
+	buf.for_each_run(start.value(), last, [&](Addr addr, const uint8_t * data, size_t len)
+	{
+		write_padding(addr - pos);
+		file.write(reinterpret_cast<const char *>(data), len);
+		pos = uint64_t(addr) + len;
+	});
+	write_padding(length - (pos - start.value()));
 }
 void IntelHex::tobinfile(const string &fileName, OptionalAddr start, OptionalAddr end, OptionalAddr size) const
 {
-	ofstream file(fileName);
+	ofstream file(fileName, ios::binary);
 	tobinfile(file, start, end, size);
 }
 
 std::vector<IntelHex::Addr> IntelHex::addresses() const
 {
 	vector<Addr> keys;
-	for (auto kv : buf)
-		keys.push_back(kv.first);
-	sort(keys.begin(), keys.end());
+	keys.reserve(buf.size());
+	buf.for_each_run([&keys](Addr addr, const uint8_t *, size_t len)
+	{
+		for (size_t i = 0; i < len; i++)
+			keys.push_back(addr + i);
+	});
 	return keys;
 }
 
 IntelHex::OptionalAddr IntelHex::minaddr() const
 {
-//	std::vector<uint32_t> keys;
-//	for (auto kv : buf)
-//		keys.push_back(kv.first);
-//	return * min_element(keys.begin(), keys.end());
-	if (buf.empty()) return {};
-	auto cmp = [](auto a, auto b)
-	{	return a.first < b.first; };
-	return  min_element(buf.begin(), buf.end(), cmp)->first;
+	return buf.min_addr();
 }
 
 IntelHex::OptionalAddr IntelHex::maxaddr() const
 {
-//	std::vector<uint32_t> keys;
-//	for (auto kv : buf)
-//		keys.push_back(kv.first);
-//	return * max_element(keys.begin(), keys.end());
-	if (buf.empty()) return {};
-	auto cmp = [](auto a, auto b)
-	{	return a.first < b.first; };
-	return  max_element(buf.begin(), buf.end(), cmp)->first;
+	return buf.max_addr();
 }
 
 void IntelHex::write_hex_file(const std::string &fileName, bool write_start_addr, uint32_t byte_count) const
@@ -260,156 +816,61 @@ void IntelHex::write_hex_file(const std::string &fileName, bool write_start_addr
 }
 void IntelHex::write_hex_file(std::ostream &file, bool write_start_addr, uint32_t byte_count) const
 {
-	if (byte_count > 255 || byte_count < 1)
-		throw length_error("wrong byte_count value");
-
-	auto make_chksum = [](BinArray & buf)
-	{
-		uint8_t chksum = 0;
-		for (size_t i = 0; i < buf.size() - 1; i++)
-			chksum += buf[i];
-		buf[buf.size() - 1] = -chksum;
-	};
+	HexRecordWriter out(file, byte_count);
 
 	// start address record if any
 	if (write_start_addr && start_addr.has_value())
 	{
-		BinArray bin(9);
 		if (holds_alternative<StartAddrSegmented>(start_addr.value()))
 		{
-			// Start Segment Address Record
-			bin[0] = 4;		// reclen
-			bin[1] = 0;		// offset msb
-			bin[2] = 0;		// offset lsb
-			bin[3] = 3;		// rectyp
 			auto addr = get<StartAddrSegmented>(start_addr.value());
-			bin[4] = addr.CS >> 8;
-			bin[5] = addr.CS;
-			bin[6] = addr.IP >> 8;
-			bin[7] = addr.IP;
-			make_chksum(bin);
-
-			file << ":" << hexlify(bin) << endl;
+			out.start_segment(addr.CS, addr.IP);
 		}
 		else
 		if (holds_alternative<StartAddrExtended>(start_addr.value()))
 		{
-			// Start Linear Address Record
-			bin[0] = 4;		// reclen
-			bin[1] = 0;		// offset msb
-			bin[2] = 0;		// offset lsb
-			bin[3] = 5;		// rectyp
 			auto addr = get<StartAddrExtended>(start_addr.value());
-			bin[4] = (addr.EIP >> 24) & 0xFF;
-			bin[5] = (addr.EIP >> 16) & 0xFF;
-			bin[6] = (addr.EIP >>  8) & 0xFF;
-			bin[7] = (addr.EIP >>  0) & 0xFF;
-			make_chksum(bin);
-
-			file << ":" << hexlify(bin) << endl;
+			out.start_linear(addr.EIP);
 		}
 	}
 
 	// data
-	if (! buf.empty())
-	{
-		const auto addresses = this->addresses();
-		const uint32_t addr_len = addresses.size();
-		const Addr maxaddr = * this->maxaddr();
-		const bool need_offset_record = (maxaddr > 65535);
-
-		Addr high_ofs = 0;
-		uint32_t cur_ix = 0;
+	// images above 64K get address record for every 64K region, including the first one
+	if (maxaddr().value_or(0) > 65535)
+		out.force_address_record();
+	buf.for_each_run([&out](Addr addr, const uint8_t * data, size_t len)
+	{	out.data(addr, data, len);	});
 
-		for (auto cur_addr = *addresses.begin(); cur_addr <= maxaddr; )
-		{
-			if (need_offset_record)
-			{
-				BinArray bin(7);
-				bin[0] = 2;		// reclen
-				bin[1] = 0;		// offset msb
-				bin[2] = 0;		// offset lsb
-				bin[3] = 4;		// rectyp
-				high_ofs = cur_addr >> 16;
-				bin[4] = high_ofs >> 8;	// msb of high_ofs
-				bin[5] = high_ofs;		// lsb of high_ofs
-				make_chksum(bin);
-
-				file << ":" << hexlify(bin) << endl;
-			}
-			while(true)
-			{
-				// produce one record
-				const uint16_t low_addr = cur_addr & 0xFFFF;
-				// chain_len off by 1
-				size_t chain_len =
-						min(byte_count-1,
-							min(uint32_t(0xFFFF - low_addr), maxaddr - cur_addr));
-
-				// search continuous chain
-				const auto stop_addr = cur_addr + chain_len;
-				if (chain_len)
-				{
-					auto ix = upper_bound(
-						addresses.begin() + min(uint32_t(cur_ix+chain_len+1), cur_ix),
-						addresses.end(),
-						stop_addr);
-					if (ix != addresses.end())
-						chain_len = *ix - cur_ix;     // real chain_len
-					else
-						chain_len = addr_len - cur_ix;
-
-					// there could be small holes in the chain
-					// but we will catch them by try-except later
-					// so for big continuous files we will work
-					// at maximum possible speed
-				}
-				else
-					chain_len = 1;	// real chain_len
-
-
-				BinArray bin(5 + chain_len, 0x00);
-
-				bin[1] = low_addr >> 8;	// msb of low_addr
-				bin[2] = low_addr;		// lsb of low_addr
-				bin[3] = 0;				// rectype
-				size_t i = 0;
-				try {    // if there is small holes we'll catch them
-					for ( ; i < chain_len; i++)
-						bin[4 + i] = buf.at(cur_addr + i);
-				}
-				catch (const out_of_range &)
-				{
-					// we catch a hole so we should shrink the chain
-					chain_len = i;
-					bin.resize(5 + i);
-				}
-
-				bin[0] = chain_len;
-				make_chksum(bin);
+	out.finish();
+}
 
-				file << ":" << hexlify(bin) << endl;
 
+void IntelHex::save_snapshot(std::ostream &file) const
+{
+	HexSnapshot::write(file, *this);
+}
 
-				// adjust cur_addr/cur_ix
-				cur_ix += chain_len;
-				if (cur_ix < addr_len)
-					cur_addr = addresses[cur_ix];
-				else
-				{
-					cur_addr = maxaddr + 1;
-					break;
-				}
-				Addr high_addr = cur_addr >> 16;
-				if (high_addr > high_ofs)
-					break;
-			}
-		}
-	}
+void IntelHex::save_snapshot(const std::string &fileName) const
+{
+	ofstream file(fileName, ios::binary);
+	if (file)
+		save_snapshot(file);
+	if (! file.flush())
+		throw system_error(make_error_code(errc::io_error), fileName);
+}
 
-	// end-of-file record
-	file << ":00000001FF" << endl;
+void IntelHex::load_snapshot(const std::string &fileName)
+{
+	load_snapshot(HexSnapshot(fileName));
+}
 
+void IntelHex::load_snapshot(const HexSnapshot &snapshot)
+{
+	buf.clear();
+	for (auto & seg : snapshot.segments())
+		buf.write(seg.begin, seg.data, seg.length);
+	padding = snapshot.padding();
+	start_addr = snapshot.start_addr();
 }
 
 
@@ -419,105 +880,165 @@ void IntelHex::merge(const IntelHex &other, Overlap overlap)
 		throw logic_error("Can't merge itself");
 
 	// merge data
-	for (auto i : other.buf)
+	if (overlap == Overlap::error)
 	{
-		if (buf.count(i.first))
+		// intersect segments first, so nothing is merged on error
+		other.buf.for_each_segment([this](Addr first, Addr last)
 		{
-			if (overlap == Overlap::error)
+			if (auto used = buf.find_used(first, size_t(last - first) + 1))
 			{
 				stringstream ss;
-				ss << "Data overlapped at address 0x" << hex << i.first;
+				ss << "Data overlapped at address 0x" << hex << used.value();
 				throw AddressOverlapError(ss.str());
 			}
-			else if (overlap == Overlap::ignore)
-				continue;
-		}
-		buf[i.first] = i.second;
+		});
 	}
 
-	// merge start_addr
-	if (! (start_addr == other.start_addr))
+	other.buf.for_each_run([&](Addr addr, const uint8_t * data, size_t len)
+	{
+		if (overlap != Overlap::ignore)
+			return buf.write(addr, data, len);
+
+		// copy pieces between our segments
+		const uint64_t end = uint64_t(addr) + len;
+		for (uint64_t pos = addr; pos < end; )
+		{
+			const auto used = buf.find_used(Addr(pos), size_t(end - pos));
+			const uint64_t stop = used ? used.value() : end;
+			buf.write(Addr(pos), data + (pos - addr), size_t(stop - pos));
+			if (! used)
+				break;
+			pos = uint64_t(buf.segment_last(used.value()).value()) + 1;
+		}
+	});
+
+	merge_start_addr(other.start_addr, overlap);
+}
+
+void IntelHex::merge_start_addr(const StartAddr &other, Overlap overlap)
+{
+	if (! (start_addr == other))
 	{
 		if (! start_addr.has_value())		// set start addr from other
-			start_addr = other.start_addr;
-		else if (! other.start_addr.has_value())  // keep existing start addr
+			start_addr = other;
+		else if (! other.has_value())  // keep existing start addr
 			; // do nothing
 		else						// conflict
 		{
 			if (overlap == Overlap::error)
 				throw AddressOverlapError("Starting addresses are different");
 			else if (overlap == Overlap::replace)
-				start_addr = other.start_addr;
+				start_addr = other;
 		}
 	}
 }
 
-vector<IntelHex::Segment> IntelHex::segments()
+IntelHex IntelHex::merge_all(const vector<const IntelHex *> &images, Overlap overlap,
+							 vector<MergeConflict> *conflicts)
 {
-	vector<Segment> seg;
-	const auto addr = addresses();
-
-	if (addr.empty())
-		return seg;
-	else if (addr.size() == 1)
+	// Segment boundaries of all inputs are swept in address order (k-way merge
+	// with a heap). Between two boundaries the set of inputs with data is constant:
+	// the first of them wins with Overlap::ignore, the last one with Overlap::replace.
+	struct Input {
+		std::vector<std::pair<uint64_t, uint64_t>> segs;	// [begin, end)
+		size_t next = 0;		// boundary index: 2*segment + (0 - begin, 1 - end)
+		uint64_t boundary() const
+		{	return (next & 1) ? segs[next / 2].second : segs[next / 2].first;	}
+	};
+	std::vector<Input> inputs(images.size());
+	using Event = std::pair<uint64_t, size_t>;		// address, input
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+	for (size_t i = 0; i < images.size(); i++)
 	{
-		seg.push_back({addr[0], addr[0]+1});
-		return seg;
+		auto & segs = inputs[i].segs;
+		segs.reserve(images[i]->buf.segment_count());
+		images[i]->buf.for_each_segment([&segs](Addr first, Addr last)
+		{	segs.push_back({ first, uint64_t(last) + 1 });	});
+		if (! segs.empty())
+			events.push({ segs[0].first, i });
 	}
 
-//	adjacent_differences = [(b - a) for (a, b) in zip(addresses[:-1], addresses[1:])]
-//	breaks = [i for (i, x) in enumerate(adjacent_differences) if x > 1]
-//	endings = [addresses[b] for b in breaks]
-//	endings.append(addresses[-1])
-//	beginings = [addresses[b+1] for b in breaks]
-//	beginings.insert(0, addresses[0])
-//	return [(a, b+1) for (a, b) in zip(beginings, endings)]
-
-	Addr start = addr[0];
-	// search break
-	for (size_t i = 0; i < addr.size() - 1; i++)
-		if (addr[i] + 1 != addr[i + 1])
+	struct Piece {
+		uint64_t begin, end;
+		size_t input;
+	};
+	std::vector<Piece> pieces;			// winning input of every address range
+	std::vector<MergeConflict> found;
+	std::map<std::pair<size_t, size_t>, size_t> last_conflict;		// index in found
+	std::set<size_t> active;			// inputs with data at current address
+	uint64_t pos = 0;
+	while (! events.empty())
+	{
+		const uint64_t addr = events.top().first;
+		if (addr > pos && ! active.empty())
 		{
-			seg.push_back({start, addr[i]+1});
-			start = addr[i + 1];
+			const size_t winner = (overlap == Overlap::replace) ? *active.rbegin() : *active.begin();
+			if (! pieces.empty() && pieces.back().end == pos && pieces.back().input == winner)
+				pieces.back().end = addr;
+			else
+				pieces.push_back({ pos, addr, winner });
+
+			// every pair of active inputs collides here
+			for (auto i = active.begin(); i != active.end(); ++i)
+				for (auto j = std::next(i); j != active.end(); ++j)
+				{
+					// continue conflict of this pair which ends here
+					auto last = last_conflict.find({ *i, *j });
+					if (last != last_conflict.end() && found[last->second].end == Addr(pos))
+						found[last->second].end = Addr(addr);
+					else
+					{
+						last_conflict[{ *i, *j }] = found.size();
+						found.push_back({ Addr(pos), Addr(addr), *i, *j });
+					}
+				}
 		}
+		pos = addr;
 
-	// last segment
-	seg.push_back({start, addr[addr.size()-1]+1});
-
-
-	return seg;
-}
-
+		// all boundaries at this address
+		while (! events.empty() && events.top().first == addr)
+		{
+			const size_t i = events.top().second;
+			events.pop();
+			Input & in = inputs[i];
+			if (in.next & 1)
+				active.erase(i);
+			else
+				active.insert(i);
+			if (++in.next < 2 * in.segs.size())
+				events.push({ in.boundary(), i });
+		}
+	}
 
-IntelHex::BinArray IntelHex::unhexlify(const string &inp)
-{
-	if (inp.length() % 2)
-		throw length_error("Hex string: non-even length");
+	if (conflicts)
+		*conflicts = found;
+	if (! found.empty() && overlap == Overlap::error)
+	{
+		stringstream ss;
+		ss << "Data overlapped at address 0x" << hex << found[0].begin << dec
+		   << " (images " << found[0].first << " and " << found[0].second << ")";
+		throw AddressOverlapError(ss.str());
+	}
 
-	BinArray res;
-	for (size_t i = 0; i < inp.length() - 1; i += 2)
+	// every byte is written once, in ascending order
+	IntelHex res;
+	for (auto & p : pieces)
 	{
-		const auto hi = inp[i];
-		const auto lo = inp[i + 1];
-		res.push_back(
-			(hi >= 'A' ? hi - 'A' + 10 : hi - '0') * 16 +
-			(lo >= 'A' ? lo - 'A' + 10 : lo - '0'));
+		images[p.input]->buf.for_each_run(Addr(p.begin), Addr(p.end - 1), [&res](Addr addr, const uint8_t * data, size_t len)
+		{	res.buf.write(addr, data, len);	});
 	}
+	for (auto image : images)
+		res.merge_start_addr(image->start_addr, overlap);
 	return res;
 }
 
-std::string IntelHex::hexlify(const BinArray &bin)
+vector<IntelHex::Segment> IntelHex::segments() const
 {
-	string str;
-	for (const auto b : bin)
+	vector<Segment> seg;
+	seg.reserve(buf.segment_count());
+	buf.for_each_segment([&seg](Addr first, Addr last)
 	{
-		auto hex = [](uint8_t b) -> char {
-			return (b < 10) ? (b + '0') : (b - 10 + 'A');
-		};
-		str += hex(b >> 4);
-		str += hex(b & 0x0F);
-	}
-	return str;
-
+		seg.push_back({first, Addr(last + 1)});
+	});
+	return seg;
 }
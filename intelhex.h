@@ -6,9 +6,23 @@
 #include <variant>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <fstream>
+#include "intelhex_exception.h"
+#include "intelhex_memory.h"
+#include "intelhex_storage.h"
 
 
+// Storage backend is selected at compile time:
+// define INTELHEX_PAGED_STORAGE to use PagedStorage (O(1) access, best for dense images),
+// INTELHEX_PAGE_SIZE sets its page size (power of two, e.g. flash sector size).
+#ifndef INTELHEX_PAGE_SIZE
+#define INTELHEX_PAGE_SIZE 0x1000
+#endif
+
+
+struct HexRecord;
+class HexSnapshot;
 
 class IntelHex
 {
@@ -19,6 +33,14 @@ public:
 
 	IntelHex()	{}
 
+	// Storage and scratch buffers of loading (except the line buffer of
+	// stream loading) are allocated from resource,
+	// e.g. std::pmr::monotonic_buffer_resource of a request.
+	// Resource should outlive the object and its copies. It is used by
+	// the calling thread only, but copies modified by other threads use it too.
+	explicit IntelHex(std::pmr::memory_resource * resource)
+		: buf(std::make_shared<MemoryAccount>(std::shared_ptr<MemoryHook>(), resource))	{}
+
 	IntelHex(const std::string &fileName)
 	{	loadhex(fileName);	}
 
@@ -26,20 +48,55 @@ public:
 	{	loadhex(file);	}
 
 	IntelHex(std::initializer_list<std::pair<Addr, uint8_t> > init)
-	{	for (auto & i : init)	buf[i.first] = i.second;	}
+	{	for (auto & i : init)	buf.set(i.first, i.second);	}
 
 	void loadhex(std::istream &file);
 	void loadhex(const std::string &fileName)
 	{	std::ifstream f(fileName);	loadhex(f);	}
+	// Parse records straight from memory-mapped file (pipes are read into a buffer).
+	// Big files can be decoded by several threads (0 - use all hardware threads).
+	// Throws std::system_error if file can't be opened.
+	void loadhex_mmap(const std::string &fileName, unsigned threads = 1);
+
+	// Non-throwing variants of loadhex*(), for checking lots of files.
+	// Error code, line number and byte offset of the line are returned,
+	// nothing is allocated on error. Records before the error are loaded.
+	// HexError::io is returned if file can't be opened or read.
+	HexResult try_loadhex(std::istream &file);
+	HexResult try_loadhex(const std::string &fileName);
+	HexResult try_loadhex_mmap(const std::string &fileName, unsigned threads = 1);
+	// HEX text already in memory, e.g. a mapped file
+	HexResult try_loadhex_text(std::string_view text, unsigned threads = 1)
+	{	return loadhex_text(text, threads);	}
+
+	// What to do with a bad record in lenient mode
+	enum class LenientPolicy {
+		skip,		// bad records are not loaded
+		apply,		// records which could be decoded are loaded anyway:
+					// bad checksum is ignored, overlapped data and duplicate start address replace old ones
+	};
+	// Lenient loading: every problem is reported, loading goes on with the next record.
+	// The whole file is checked in one pass.
+	std::vector<HexDiagnostic> loadhex_lenient(std::istream &file, LenientPolicy policy = LenientPolicy::skip);
+	std::vector<HexDiagnostic> loadhex_lenient(const std::string &fileName, LenientPolicy policy = LenientPolicy::skip)
+	{	std::ifstream f(fileName);	return loadhex_lenient(f, policy);	}
 
 	void loadbin(std::istream &file, Addr offset=0);
-	void loadbin(const std::string &fileName, Addr offset=0)
-	{	std::ifstream f(fileName); loadbin(f, offset);	}
+	// File is memory-mapped and copied into storage at once.
+	// As with loadhex(fileName), a file which can't be opened loads nothing.
+	void loadbin(const std::string &fileName, Addr offset=0);
 
-	void frombytes(const BinArray &bytes, Addr offset=0);
+	// Place a range of bytes at offset, existing data is overwritten.
+	void frombytes(const uint8_t * data, size_t size, Addr offset=0)
+	{	buf.write(offset, data, size);	}
+	void frombytes(const BinArray &bytes, Addr offset=0)
+	{	frombytes(bytes.data(), bytes.size(), offset);	}
 
 	// Return binary array
 	BinArray tobinarray(OptionalAddr start = {}, OptionalAddr end = {}, OptionalAddr size = {}) const;
+	// Fill caller-supplied buffer with content of addresses [start, start+size),
+	// holes are filled with padding.
+	void tobinbuffer(Addr start, uint8_t * dst, size_t size) const;
 
 	// Convert to binary and write to file
 	void tobinfile(std::ostream & file, OptionalAddr start = {}, OptionalAddr end = {}, OptionalAddr size = {}) const;
@@ -54,14 +111,14 @@ public:
 
 	uint8_t operator[](Addr addr) const
 	{
-		auto it = buf.find(addr);
-		return (it != buf.end()) ? it->second : padding;
+		auto data = buf.find(addr);
+		return data ? *data : padding;
 	}
 //	uint8_t & operator[](Addr addr)
 //	{	return buf[addr];	}
 
 	void add(Addr addr, uint8_t data)
-	{	buf.insert_or_assign(addr, data);	}
+	{	buf.set(addr, data);	}
 
 	void del(Addr addr)
 	{	buf.erase(addr);	}
@@ -73,11 +130,34 @@ public:
 	void write_hex_file(std::ostream & file, bool write_start_addr=true, uint32_t byte_count=16) const;
 	void write_hex_file(const std::string & fileName, bool write_start_addr=true, uint32_t byte_count=16) const;
 
+	// Binary snapshot of the image: data, start address and padding (see intelhex_snapshot.h).
+	// Loading replaces content of the object, no parsing is needed.
+	// Throws SnapshotError if file is not a valid snapshot, std::system_error if it can't be opened/written.
+	void save_snapshot(std::ostream & file) const;
+	void save_snapshot(const std::string & fileName) const;
+	void load_snapshot(const std::string & fileName);
+	void load_snapshot(const HexSnapshot & snapshot);
+
 	enum class Overlap {
 		error, ignore, replace
 	};
+	// Merge content of other object. Data is copied by contiguous ranges.
+	// With Overlap::error nothing is merged if data overlaps.
 	void merge(const IntelHex & other, Overlap overlap=Overlap::error);
 
+	// Overlap of two merge_all() inputs: addresses [begin, end) are used by both
+	struct MergeConflict {
+		Addr begin;
+		Addr end;
+		size_t first;		// index of the first input
+		size_t second;		// index of the second input, first < second
+	};
+	// Merge many images in one pass. The result is the same as merging them
+	// one by one into an empty object; with Overlap::error nothing is built if
+	// data overlaps. Every overlap is reported to conflicts, if given.
+	static IntelHex merge_all(const std::vector<const IntelHex *> & images, Overlap overlap=Overlap::error,
+							  std::vector<MergeConflict> * conflicts = nullptr);
+
 	uint8_t padding = 0xFF;
 
 
@@ -99,24 +179,82 @@ public:
 		Addr begin;
 		Addr end;
 	};
-	std::vector<Segment> segments();
+	// Segments are tracked by storage on every change, so this costs O(number of segments).
+	std::vector<Segment> segments() const;
+
+	// Summary of HEX file, see validate()
+	struct Summary {
+		HexResult result;				// first error, if any
+		size_t data_records = 0;
+		size_t data_bytes = 0;
+		std::vector<Segment> segments;	// contiguous ranges of data
+		StartAddr start_addr;
+	};
+	// Check HEX file without building an image: the same checks as loadhex()
+	// (syntax, checksums, duplicate start address, overlaps), but only ranges
+	// of data are kept. Checking stops at the first error, summary describes
+	// records before it. Files are memory-mapped.
+	static Summary validate(std::istream &file);
+	static Summary validate(const std::string &fileName);
+
+	// Load many HEX files concurrently (threads = 0 - use all hardware threads).
+	// Every thread takes the next file of the list when it is done with the previous one,
+	// so at most 'threads' files are in memory at once. Results are in input order.
+	struct LoadResult;
+	static std::vector<LoadResult> load_many(const std::vector<std::string> &fileNames, unsigned threads = 0);
+
+	// Memory used by the object
+	struct MemoryStats {
+		size_t payload = 0;		// bytes of data, the same as size()
+		size_t allocated = 0;	// bytes allocated by storage: data blocks and containers
+		size_t overhead = 0;	// allocated - payload
+		size_t blocks = 0;		// extents or pages of storage
+		size_t segments = 0;	// contiguous ranges of data
+		size_t peak = 0;		// maximum of allocated during the last load
+	};
+	// Copies of an image share storage blocks until they are modified,
+	// so memory is counted for the image and its copies together.
+	MemoryStats memory_stats() const;
 
+	// Report memory of the object to hook, e.g. MemoryBudget to limit memory of a request.
+	// Loaded data is moved to a new memory account; copies made later share the hook.
+	// If the hook refuses an allocation during loading, the image is cleared
+	// and HexError::memory_limit is returned (or MemoryLimitError is thrown);
+	// other functions throw MemoryLimitError and leave content of the image unspecified.
+	void set_memory_hook(std::shared_ptr<MemoryHook> hook);
 
-private:
+	// Move data to another memory resource (see IntelHex(memory_resource *)),
+	// memory hook is kept.
+	void set_memory_resource(std::pmr::memory_resource * resource);
+	std::pmr::memory_resource * memory_resource() const;
 
-	std::map<Addr, uint8_t> buf;
 
-	uint32_t offset = 0;
+private:
 
-	bool decode_record(std::string s, uint32_t line=0);
+#ifdef INTELHEX_PAGED_STORAGE
+	using Storage = PagedStorage<INTELHEX_PAGE_SIZE>;
+#else
+	using Storage = ExtentStorage;
+#endif
+	Storage buf;
+
+	HexResult apply_record(const HexRecord & rec);
+	HexResult store(Addr addr, const uint8_t * data, size_t len);
+	void reset_memory_peak();
+	void move_storage(std::shared_ptr<MemoryAccount> account);
+	void merge_start_addr(const StartAddr & other, Overlap overlap);
+	HexResult loadhex_text(std::string_view text);
+	HexResult loadhex_text(std::string_view text, unsigned threads);
+	HexResult loadhex_file(const std::string &fileName, std::vector<char> &scratch);
 
 	std::pair<OptionalAddr, OptionalAddr>
 		get_start_end(OptionalAddr start = {}, OptionalAddr end = {}, OptionalAddr size = {}) const;
 
+};
 
-	static BinArray unhexlify(const std::string& input);
-	static std::string hexlify(const BinArray& bin);
-
+struct IntelHex::LoadResult {
+	IntelHex image;
+	HexResult result;		// image contains records before the error
 };
 
 
@@ -0,0 +1,234 @@
+#include "intelhex_cache.h"
+#include "intelhex_exception.h"
+#include "intelhex_io.h"
+#include "intelhex_snapshot.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+// 64-bit xxHash (XXH64) of the data
+uint64_t xxh64(const uint8_t * p, size_t len, uint64_t seed = 0)
+{
+	const uint64_t P1 = 11400714785074694791ull;
+	const uint64_t P2 = 14029467366897019727ull;
+	const uint64_t P3 = 1609587929392839161ull;
+	const uint64_t P4 = 9650029242287828579ull;
+	const uint64_t P5 = 2870177450012600261ull;
+
+	auto rotl = [](uint64_t v, int r) {	return (v << r) | (v >> (64 - r));	};
+	auto read64 = [](const uint8_t * q) {	uint64_t v; memcpy(&v, q, 8); return v;	};
+	auto read32 = [](const uint8_t * q) {	uint32_t v; memcpy(&v, q, 4); return v;	};
+	auto round = [&](uint64_t acc, uint64_t input) {	return rotl(acc + input * P2, 31) * P1;	};
+	auto merge = [&](uint64_t acc, uint64_t v) {	return (acc ^ round(0, v)) * P1 + P4;	};
+
+	const uint8_t * const end = p + len;
+	uint64_t h;
+	if (len >= 32)
+	{
+		uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+		for ( ; p + 32 <= end; p += 32)
+		{
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+	}
+	else
+		h = seed + P5;
+	h += len;
+
+	for ( ; p + 8 <= end; p += 8)
+		h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+	if (p + 4 <= end)
+	{
+		h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+		p += 4;
+	}
+	for ( ; p < end; p++)
+		h = rotl(h ^ (*p * P5), 11) * P1;
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+const char * const snapshot_ext = ".ihsnap";
+const char * const temp_ext = ".tmp";
+
+// Name of cache entry: format version, hash and size of HEX file
+string entry_name(const MappedFile & file)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "v1-%016llx-%llx",
+			 (unsigned long long)xxh64(reinterpret_cast<const uint8_t *>(file.data()), file.size()),
+			 (unsigned long long)file.size());
+	return name + string(snapshot_ext);
+}
+
+}
+
+
+HexCache::HexCache(const string &directory, uint64_t max_bytes)
+	: dir(directory), max_bytes(max_bytes)
+{
+	// failure is counted by store()
+	error_code ec;
+	fs::create_directories(dir, ec);
+}
+
+IntelHex HexCache::load(const string &fileName)
+{
+	std::optional<MappedFile> mapped;
+	try {
+		mapped.emplace(fileName);
+	}
+	catch (const system_error &)
+	{
+		HexResult res;
+		res.error = HexError::io;
+		throw_hex_error(res);
+	}
+	const MappedFile & file = *mapped;
+	const fs::path path = fs::path(dir) / entry_name(file);
+
+	IntelHex ih;
+	error_code ec;
+	if (fs::exists(path, ec))
+	{
+		try {
+			ih.load_snapshot(path.string());
+			fs::last_write_time(path, fs::file_time_type::clock::now(), ec);		// LRU order
+			hits++;
+			return ih;
+		}
+		catch (const SnapshotError &)
+		{
+			// broken entry: rewrite it
+			errors++;
+		}
+		catch (const system_error &)
+		{
+			// removed by another process
+		}
+	}
+
+	misses++;
+	ih = IntelHex();
+	// the same text which was hashed
+	const HexResult res = ih.try_loadhex_text(file.view());
+	if (! res.ok())
+		throw_hex_error(res);
+	store(path.string(), ih);
+	return ih;
+}
+
+// Write snapshot to a temporary file and rename it into place,
+// so other processes see either nothing or the whole snapshot.
+void HexCache::store(const string &path, const IntelHex &ih)
+{
+	static thread_local mt19937_64 rnd(random_device{}());
+	const string temp = path + "." + to_string(rnd()) + temp_ext;
+	error_code ec;
+	fs::create_directories(dir, ec);		// could be removed meanwhile
+	try {
+		ih.save_snapshot(temp);
+		fs::rename(temp, path);
+	}
+	catch (const exception &)
+	{
+		errors++;
+		fs::remove(temp, ec);
+		return;
+	}
+	evict();
+}
+
+// Remove least recently used snapshots to fit max_bytes.
+// Temporary files left by crashed writers are removed after a while.
+void HexCache::evict()
+{
+	struct Entry {
+		fs::path path;
+		uint64_t size;
+		fs::file_time_type time;
+	};
+	vector<Entry> entries;
+	uint64_t total = 0;
+	const auto now = fs::file_time_type::clock::now();
+
+	error_code ec;
+	for (fs::directory_iterator it(dir, ec), end; ! ec && it != end; it.increment(ec))
+	{
+		const auto & path = it->path();
+		const auto ext = path.extension();
+		const uint64_t size = it->file_size(ec);
+		const auto time = it->last_write_time(ec);
+		if (ec)
+		{
+			ec.clear();
+			continue;
+		}
+		if (ext == temp_ext)
+		{
+			if (now - time > chrono::hours(1))
+				fs::remove(path, ec);
+		}
+		else if (ext == snapshot_ext)
+		{
+			entries.push_back({ path, size, time });
+			total += size;
+		}
+	}
+	if (total <= max_bytes)
+		return;
+
+	sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b)
+	{	return a.time < b.time;	});
+	for (auto & e : entries)
+	{
+		if (total <= max_bytes)
+			break;
+		if (fs::remove(e.path, ec))
+			evictions++;
+		total -= e.size;
+	}
+}
+
+HexCache::Stats HexCache::stats() const
+{
+	Stats s;
+	s.hits = hits;
+	s.misses = misses;
+	s.evictions = evictions;
+	s.errors = errors;
+	return s;
+}
+
+void HexCache::clear()
+{
+	error_code ec;
+	for (fs::directory_iterator it(dir, ec), end; ! ec && it != end; it.increment(ec))
+	{
+		const auto ext = it->path().extension();
+		if (ext == snapshot_ext || ext == temp_ext)
+			fs::remove(it->path(), ec);
+	}
+}
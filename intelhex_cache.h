@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "intelhex.h"
+
+
+// On-disk cache of parsed HEX files.
+// File contents are hashed (64-bit xxHash), and a snapshot of the parsed image
+// (see intelhex_snapshot.h) is kept in the cache directory under that hash.
+// When the same contents are loaded again, the snapshot is used instead of parsing.
+//
+// Several processes may share the directory: snapshots are written to temporary
+// files and renamed into place. Total size of snapshots is bounded,
+// least recently used ones are removed. The cache is best-effort:
+// problems with the directory only make it miss.
+class HexCache
+{
+public:
+	// Directory is created if it doesn't exist. If it can't be created,
+	// files are loaded without the cache (and counted in errors).
+	explicit HexCache(const std::string & directory, uint64_t max_bytes = 1ull << 30);
+
+	// Load HEX file through the cache.
+	// Errors of the file are thrown as by IntelHex::loadhex(), such files are not cached;
+	// HexFileError if the file can't be opened.
+	IntelHex load(const std::string & fileName);
+
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;		// snapshots removed to fit max_bytes
+		uint64_t errors = 0;		// snapshots which can't be written or read
+	};
+	Stats stats() const;
+
+	// Remove all snapshots
+	void clear();
+
+	const std::string & directory() const
+	{	return dir;	}
+
+private:
+	const std::string dir;
+	const uint64_t max_bytes;
+
+	std::atomic<uint64_t> hits{ 0 };
+	std::atomic<uint64_t> misses{ 0 };
+	std::atomic<uint64_t> evictions{ 0 };
+	std::atomic<uint64_t> errors{ 0 };
+
+	void store(const std::string & path, const IntelHex & ih);
+	void evict();
+};
@@ -0,0 +1,403 @@
+#include "intelhex_codec.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define HEXCODEC_X86
+	#include <immintrin.h>
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		#define HEXCODEC_TARGET_SSE2
+		#define HEXCODEC_TARGET_AVX2
+	#else
+		#define HEXCODEC_TARGET_SSE2	__attribute__((target("sse2")))
+		#define HEXCODEC_TARGET_AVX2	__attribute__((target("avx2")))
+	#endif
+#endif
+
+
+// Value of hex digit, or 0xFF for any other character.
+static const struct NibbleTable {
+	uint8_t value[256];
+	constexpr NibbleTable() : value()
+	{
+		for (int c = 0; c < 256; c++)
+			value[c] =	(c >= '0' && c <= '9') ? c - '0' :
+						(c >= 'A' && c <= 'F') ? c - 'A' + 10 :
+						(c >= 'a' && c <= 'f') ? c - 'a' + 10 : 0xFF;
+	}
+	uint8_t operator[](char c) const
+	{	return value[uint8_t(c)];	}
+} nibble;
+
+
+bool HexCodec::decode(const char *input, size_t len, uint8_t *output, uint8_t &sum)
+{
+	static const DecodeFn fn = decode_fn(best_kernel());
+	return fn(input, len, output, sum);
+}
+
+bool HexCodec::decode(Kernel kernel, const char *input, size_t len, uint8_t *output, uint8_t &sum)
+{
+	return decode_fn(kernel)(input, len, output, sum);
+}
+
+uint8_t HexCodec::encode(const uint8_t *input, size_t len, char *output)
+{
+	static const EncodeFn fn = encode_fn(best_kernel());
+	return fn(input, len, output);
+}
+
+uint8_t HexCodec::encode(Kernel kernel, const uint8_t *input, size_t len, char *output)
+{
+	return encode_fn(kernel)(input, len, output);
+}
+
+HexCodec::DecodeFn HexCodec::decode_fn(Kernel kernel)
+{
+	switch (kernel)
+	{
+#ifdef HEXCODEC_X86
+	case Kernel::avx2:	return decode_avx2;
+	case Kernel::sse2:	return decode_sse2;
+#endif
+	default:			return decode_scalar;
+	}
+}
+
+HexCodec::EncodeFn HexCodec::encode_fn(Kernel kernel)
+{
+	switch (kernel)
+	{
+#ifdef HEXCODEC_X86
+	case Kernel::avx2:	return encode_avx2;
+	case Kernel::sse2:	return encode_sse2;
+#endif
+	default:			return encode_scalar;
+	}
+}
+
+bool HexCodec::supported(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::scalar:
+		return true;
+#ifdef HEXCODEC_X86
+	case Kernel::sse2:
+	#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_cpu_supports("sse2");
+	#else
+		return true;
+	#endif
+	case Kernel::avx2:
+	#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_cpu_supports("avx2");
+	#else
+		{
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7) return false;
+			__cpuid(info, 1);
+			const bool osxsave = info[2] & (1 << 27);
+			const bool avx = info[2] & (1 << 28);
+			if (! osxsave || ! avx || (_xgetbv(0) & 6) != 6) return false;
+			__cpuidex(info, 7, 0);
+			return info[1] & (1 << 5);
+		}
+	#endif
+#endif
+	default:
+		return false;
+	}
+}
+
+HexCodec::Kernel HexCodec::best_kernel()
+{
+	if (supported(Kernel::avx2))
+		return Kernel::avx2;
+	if (supported(Kernel::sse2))
+		return Kernel::sse2;
+	return Kernel::scalar;
+}
+
+const char * HexCodec::name(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::avx2:	return "avx2";
+	case Kernel::sse2:	return "sse2";
+	default:			return "scalar";
+	}
+}
+
+bool HexCodec::is_hex(const char *input, size_t len)
+{
+	uint8_t bad = 0;
+	for (size_t i = 0; i < len; i++)
+		bad |= nibble[input[i]];
+	return ! (bad & 0xF0);
+}
+
+
+bool HexCodec::decode_scalar(const char *input, size_t len, uint8_t *output, uint8_t &sum)
+{
+	uint8_t bad = 0;
+	uint8_t s = 0;
+	for (size_t i = 0; i + 1 < len; i += 2)
+	{
+		const uint8_t hi = nibble[input[i]];
+		const uint8_t lo = nibble[input[i + 1]];
+		bad |= hi | lo;
+		const uint8_t b = uint8_t(hi << 4 | lo);
+		*output++ = b;
+		s += b;
+	}
+	sum = s;
+	return ! (bad & 0xF0);
+}
+
+uint8_t HexCodec::encode_scalar(const uint8_t *input, size_t len, char *output)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	uint8_t s = 0;
+	for (size_t i = 0; i < len; i++)
+	{
+		const uint8_t b = input[i];
+		*output++ = digits[b >> 4];
+		*output++ = digits[b & 0x0F];
+		s += b;
+	}
+	return s;
+}
+
+
+#ifdef HEXCODEC_X86
+
+// Convert 16 hex characters to nibbles, set 'valid' bytes to 0xFF for hex digits.
+// All ASCII codes are positive, so signed compares are fine;
+// bytes >= 0x80 are negative and fail every range check.
+HEXCODEC_TARGET_SSE2
+static inline __m128i nibbles_sse2(__m128i c, __m128i & valid)
+{
+	const __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+										_mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+	const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+										_mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+	valid = _mm_or_si128(digit, alpha);
+	return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+						_mm_and_si128(alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+}
+
+// Join pairs of nibbles (hi, lo) of each 16-bit lane into (hi << 4 | lo)
+HEXCODEC_TARGET_SSE2
+static inline __m128i join_sse2(__m128i n)
+{
+	return _mm_or_si128(_mm_and_si128(_mm_slli_epi16(n, 4), _mm_set1_epi16(0x00F0)),
+						_mm_srli_epi16(n, 8));
+}
+
+// Decode 32 hex characters into 16 bytes, clear bits of 'valid' for non-hex characters
+HEXCODEC_TARGET_SSE2
+static inline __m128i block_sse2(const char * input, int & valid)
+{
+	__m128i v0, v1;
+	const __m128i n0 = nibbles_sse2(_mm_loadu_si128((const __m128i *)input), v0);
+	const __m128i n1 = nibbles_sse2(_mm_loadu_si128((const __m128i *)(input + 16)), v1);
+	valid &= _mm_movemask_epi8(_mm_and_si128(v0, v1));
+	return _mm_packus_epi16(join_sse2(n0), join_sse2(n1));
+}
+
+// zeros, then ones: loading from offset n masks out first 16-n bytes
+alignas(16) static const uint8_t tail_mask[32] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Decode characters [i, len) by 32, len >= 32.
+// Last incomplete block is decoded overlapped with the previous one,
+// only new bytes are added to the checksum.
+HEXCODEC_TARGET_SSE2
+static inline void decode_rest_sse2(const char * input, size_t i, size_t len, uint8_t * output,
+									__m128i & acc, int & valid)
+{
+	for ( ; i + 32 <= len; i += 32)
+	{
+		const __m128i bytes = block_sse2(input + i, valid);
+		_mm_storeu_si128((__m128i *)(output + i / 2), bytes);
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+	}
+	if (i < len)
+	{
+		const size_t fresh = (len - i) / 2;
+		const __m128i bytes = block_sse2(input + len - 32, valid);
+		_mm_storeu_si128((__m128i *)(output + len / 2 - 16), bytes);
+		const __m128i mask = _mm_loadu_si128((const __m128i *)(tail_mask + fresh));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_and_si128(bytes, mask), _mm_setzero_si128()));
+	}
+}
+
+HEXCODEC_TARGET_SSE2
+static inline uint8_t fold_sum_sse2(__m128i acc)
+{
+	return uint8_t(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+}
+
+HEXCODEC_TARGET_SSE2
+bool HexCodec::decode_sse2(const char *input, size_t len, uint8_t *output, uint8_t &sum)
+{
+	len &= ~size_t(1);
+	if (len < 32)
+		return decode_scalar(input, len, output, sum);
+
+	__m128i acc = _mm_setzero_si128();
+	int valid = 0xFFFF;
+	decode_rest_sse2(input, 0, len, output, acc, valid);
+	sum = fold_sum_sse2(acc);
+	return valid == 0xFFFF;
+}
+
+
+// Convert 16 nibbles (values 0..15) to upper case hex digits
+HEXCODEC_TARGET_SSE2
+static inline __m128i digits_sse2(__m128i n)
+{
+	const __m128i letter = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+	return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')),
+						_mm_and_si128(letter, _mm_set1_epi8('A' - '0' - 10)));
+}
+
+// Encode 16 bytes into 32 hex characters
+HEXCODEC_TARGET_SSE2
+static inline void encode_block_sse2(__m128i bytes, char * output)
+{
+	const __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F));
+	const __m128i lo = _mm_and_si128(bytes, _mm_set1_epi8(0x0F));
+	const __m128i dhi = digits_sse2(hi);
+	const __m128i dlo = digits_sse2(lo);
+	_mm_storeu_si128((__m128i *)output, _mm_unpacklo_epi8(dhi, dlo));
+	_mm_storeu_si128((__m128i *)(output + 16), _mm_unpackhi_epi8(dhi, dlo));
+}
+
+// Encode bytes [i, len) by 16, len >= 16.
+// Last incomplete block is encoded overlapped with the previous one.
+HEXCODEC_TARGET_SSE2
+static inline void encode_rest_sse2(const uint8_t * input, size_t i, size_t len, char * output, __m128i & acc)
+{
+	for ( ; i + 16 <= len; i += 16)
+	{
+		const __m128i bytes = _mm_loadu_si128((const __m128i *)(input + i));
+		encode_block_sse2(bytes, output + 2 * i);
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+	}
+	if (i < len)
+	{
+		const size_t fresh = len - i;
+		const __m128i bytes = _mm_loadu_si128((const __m128i *)(input + len - 16));
+		encode_block_sse2(bytes, output + 2 * (len - 16));
+		const __m128i mask = _mm_loadu_si128((const __m128i *)(tail_mask + fresh));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_and_si128(bytes, mask), _mm_setzero_si128()));
+	}
+}
+
+HEXCODEC_TARGET_SSE2
+uint8_t HexCodec::encode_sse2(const uint8_t *input, size_t len, char *output)
+{
+	if (len < 16)
+		return encode_scalar(input, len, output);
+	__m128i acc = _mm_setzero_si128();
+	encode_rest_sse2(input, 0, len, output, acc);
+	return fold_sum_sse2(acc);
+}
+
+
+HEXCODEC_TARGET_AVX2
+static inline __m256i nibbles_avx2(__m256i c, __m256i & valid)
+{
+	const __m256i lc = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+	const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+										   _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+	const __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lc, _mm256_set1_epi8('a' - 1)),
+										   _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lc));
+	valid = _mm256_or_si256(digit, alpha);
+	return _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+						   _mm256_and_si256(alpha, _mm256_sub_epi8(lc, _mm256_set1_epi8('a' - 10))));
+}
+
+HEXCODEC_TARGET_AVX2
+static inline __m256i join_avx2(__m256i n)
+{
+	return _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(n, 4), _mm256_set1_epi16(0x00F0)),
+						   _mm256_srli_epi16(n, 8));
+}
+
+HEXCODEC_TARGET_AVX2
+bool HexCodec::decode_avx2(const char *input, size_t len, uint8_t *output, uint8_t &sum)
+{
+	len &= ~size_t(1);
+	// short records have no 256-bit blocks: don't touch ymm registers,
+	// SSE code after them runs with state transition penalties
+	if (len < 64)
+		return decode_sse2(input, len, output, sum);
+
+	__m256i acc = _mm256_setzero_si256();
+	unsigned valid = ~0u;
+	size_t i = 0;
+	// 64 hex characters -> 32 bytes
+	for ( ; i + 64 <= len; i += 64)
+	{
+		__m256i v0, v1;
+		const __m256i n0 = nibbles_avx2(_mm256_loadu_si256((const __m256i *)(input + i)), v0);
+		const __m256i n1 = nibbles_avx2(_mm256_loadu_si256((const __m256i *)(input + i + 32)), v1);
+		valid &= unsigned(_mm256_movemask_epi8(_mm256_and_si256(v0, v1)));
+		// packus works inside 128-bit lanes, restore order of 64-bit quarters
+		const __m256i bytes = _mm256_permute4x64_epi64(
+					_mm256_packus_epi16(join_avx2(n0), join_avx2(n1)), 0xD8);
+		_mm256_storeu_si256((__m256i *)(output + i / 2), bytes);
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+	}
+
+	// rest by 128-bit blocks
+	__m128i acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	_mm256_zeroupper();
+	int valid128 = 0xFFFF;
+	decode_rest_sse2(input, i, len, output, acc128, valid128);
+	sum = fold_sum_sse2(acc128);
+	return valid == ~0u && valid128 == 0xFFFF;
+}
+
+HEXCODEC_TARGET_AVX2
+uint8_t HexCodec::encode_avx2(const uint8_t *input, size_t len, char *output)
+{
+	if (len < 32)
+		return encode_sse2(input, len, output);
+
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+	// 32 bytes -> 64 hex characters
+	for ( ; i + 32 <= len; i += 32)
+	{
+		const __m256i bytes = _mm256_loadu_si256((const __m256i *)(input + i));
+		const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F));
+		const __m256i lo = _mm256_and_si256(bytes, _mm256_set1_epi8(0x0F));
+		const __m256i digit_max = _mm256_set1_epi8(9);		// nibbles above it are letters
+		const __m256i adj = _mm256_set1_epi8('A' - '0' - 10);
+		const __m256i dhi = _mm256_add_epi8(_mm256_add_epi8(hi, _mm256_set1_epi8('0')),
+											_mm256_and_si256(_mm256_cmpgt_epi8(hi, digit_max), adj));
+		const __m256i dlo = _mm256_add_epi8(_mm256_add_epi8(lo, _mm256_set1_epi8('0')),
+											_mm256_and_si256(_mm256_cmpgt_epi8(lo, digit_max), adj));
+		// unpack works inside 128-bit lanes, reorder lanes on store
+		const __m256i a = _mm256_unpacklo_epi8(dhi, dlo);
+		const __m256i b = _mm256_unpackhi_epi8(dhi, dlo);
+		_mm256_storeu_si256((__m256i *)(output + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(output + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+	}
+
+	// rest by 128-bit blocks
+	__m128i acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	_mm256_zeroupper();
+	encode_rest_sse2(input, i, len, output, acc128);
+	return fold_sum_sse2(acc128);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+
+// Hex ASCII <-> binary conversion kernels.
+// Vectorized kernels (SSE2, AVX2) are selected at run time,
+// scalar kernel is used on other CPUs and for short tails.
+class HexCodec
+{
+public:
+	enum class Kernel {
+		scalar, sse2, avx2
+	};
+
+	// Decode len hex characters (len should be even) into len/2 bytes of output.
+	// sum receives 8-bit sum of all decoded bytes (i.e. record checksum).
+	// Both upper and lower case digits are accepted.
+	// @return false   if input contains non-hex characters.
+	static bool decode(const char * input, size_t len, uint8_t * output, uint8_t & sum);
+
+	// Encode len bytes into 2*len upper case hex characters.
+	// @return 8-bit sum of all bytes (i.e. record checksum).
+	static uint8_t encode(const uint8_t * input, size_t len, char * output);
+
+	// true if all characters are hex digits
+	static bool is_hex(const char * input, size_t len);
+
+	// Best kernel supported by this CPU
+	static Kernel best_kernel();
+	static bool supported(Kernel kernel);
+	static const char * name(Kernel kernel);
+
+	// Call particular kernel (for tests and benchmarks). Kernel should be supported.
+	static bool decode(Kernel kernel, const char * input, size_t len, uint8_t * output, uint8_t & sum);
+	static uint8_t encode(Kernel kernel, const uint8_t * input, size_t len, char * output);
+
+private:
+	using DecodeFn = bool (*)(const char *, size_t, uint8_t *, uint8_t &);
+	using EncodeFn = uint8_t (*)(const uint8_t *, size_t, char *);
+	static DecodeFn decode_fn(Kernel kernel);
+	static EncodeFn encode_fn(Kernel kernel);
+	static bool decode_scalar(const char * input, size_t len, uint8_t * output, uint8_t & sum);
+	static bool decode_sse2(const char * input, size_t len, uint8_t * output, uint8_t & sum);
+	static bool decode_avx2(const char * input, size_t len, uint8_t * output, uint8_t & sum);
+	static uint8_t encode_scalar(const uint8_t * input, size_t len, char * output);
+	static uint8_t encode_sse2(const uint8_t * input, size_t len, char * output);
+	static uint8_t encode_avx2(const uint8_t * input, size_t len, char * output);
+};
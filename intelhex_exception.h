@@ -1,96 +1,193 @@
 #pragma once
 
+#include <cstdint>
 #include <stdexcept>
 #include <sstream>
+#include <string>
+
+
+// Error codes of HEX loading, one per exception class below
+enum class HexError : uint8_t {
+	ok,
+	hex_record,						// HexRecordError
+	record_length,					// RecordLengthError
+	record_type,					// RecordTypeError
+	record_checksum,				// RecordChecksumError
+	address_overlap,				// AddressOverlapError
+	eof_record,						// EOFRecordError
+	extended_segment_address,		// ExtendedSegmentAddressRecordError
+	extended_linear_address,		// ExtendedLinearAddressRecordError
+	start_segment_address,			// StartSegmentAddressRecordError
+	start_linear_address,			// StartLinearAddressRecordError
+	duplicate_start_address,		// DuplicateStartAddressRecordError
+	io,								// file can't be opened or read
+	memory_limit,					// MemoryLimitError: allocation refused by memory hook
+};
+
+// Result of non-throwing loading functions (IntelHex::try_loadhex etc).
+// Plain value, nothing is allocated for it.
+struct HexResult {
+	HexError error = HexError::ok;
+	uint32_t line = 0;			// line number, starting from 1
+	uint64_t offset = 0;		// byte offset of the line in file
+	uint32_t address = 0;		// overlapped address for address_overlap, data address for memory_limit
+
+	bool ok() const
+	{	return error == HexError::ok;	}
+};
+
+// One problem found by lenient loading (IntelHex::loadhex_lenient)
+struct HexDiagnostic {
+	uint32_t line;			// line number, starting from 1
+	uint32_t column;		// position of bad field in the line, starting from 1
+	uint32_t address;		// overlapped address for address_overlap
+	uint8_t type;			// record type, unknown_type if record can't be decoded
+	HexError error;
+
+	static constexpr uint8_t unknown_type = 0xFF;
+};
 
 
-class IntelHexException : std::exception {
+class IntelHexException : public std::exception {
 protected:
-	std::stringstream ss;
+	std::string msg;
+
+	template <typename ... T>
+	void message(const T & ... parts)
+	{	std::ostringstream ss; (ss << ... << parts); msg = ss.str();	}
 public:
-	const char* what() const noexcept override { return ss.str().c_str(); }
+	const char* what() const noexcept override { return msg.c_str(); }
 };
 
 
 
 
-class HexRecordError : IntelHexException {
+class HexRecordError : public IntelHexException {
 public:
 	HexRecordError(uint32_t line)
-	{	ss << "Hex file contains invalid record at line " << line;	}
+	{	message("Hex file contains invalid record at line ", line);	}
 };
 
-class RecordLengthError : IntelHexException {
+class RecordLengthError : public IntelHexException {
 public:
 	RecordLengthError(uint32_t line)
-	{	ss << "Record at line " << line << " has invalid length";	}
+	{	message("Record at line ", line, " has invalid length");	}
 };
 
-class RecordTypeError : IntelHexException {
+class RecordTypeError : public IntelHexException {
 public:
 	RecordTypeError(uint32_t line)
-	{	ss << "Record at line " << line << " has invalid record type";	}
+	{	message("Record at line ", line, " has invalid record type");	}
 };
 
-class RecordChecksumError : IntelHexException {
+class RecordChecksumError : public IntelHexException {
 public:
 	RecordChecksumError(uint32_t line)
-	{	ss << "Record at line "  << line << " has invalid checksum";	}
+	{	message("Record at line ", line, " has invalid checksum");	}
 };
 
-class AddressOverlapError : IntelHexException {
+class AddressOverlapError : public IntelHexException {
 public:
 	AddressOverlapError(const std::string & str)
-	{	ss << str;	}
+	{	msg = str;	}
 	AddressOverlapError(uint32_t address, uint32_t line)
-	{	ss << "Hex file has data overlap at address 0x" << std::hex << address << std::dec
-		   << " on line " << line;	}
+	{
+		std::ostringstream ss;
+		ss << "Hex file has data overlap at address 0x" << std::hex << address << std::dec
+		   << " on line " << line;
+		msg = ss.str();
+	}
 };
 
-class EOFRecordError : IntelHexException {
+class EOFRecordError : public IntelHexException {
 public:
 	EOFRecordError(uint32_t line)
-	{	ss << "File has invalid End-of-File record at line " << line;	}
+	{	message("File has invalid End-of-File record at line ", line);	}
 };
 
-class ExtendedSegmentAddressRecordError : IntelHexException {
+class ExtendedSegmentAddressRecordError : public IntelHexException {
 public:
 	ExtendedSegmentAddressRecordError(uint32_t line)
-	{	ss << "Invalid Extended Segment Address Record at line " << line;	}
+	{	message("Invalid Extended Segment Address Record at line ", line);	}
 };
 
-class ExtendedLinearAddressRecordError : IntelHexException {
+class ExtendedLinearAddressRecordError : public IntelHexException {
 public:
 	ExtendedLinearAddressRecordError(uint32_t line)
-	{	ss << "Invalid Extended Linear Address Record at line " << line;	}
+	{	message("Invalid Extended Linear Address Record at line ", line);	}
 };
 
-class StartSegmentAddressRecordError : IntelHexException {
+class StartSegmentAddressRecordError : public IntelHexException {
 public:
 	StartSegmentAddressRecordError(uint32_t line)
-	{	ss << "Invalid Start Segment Address Record at line " << line;	}
+	{	message("Invalid Start Segment Address Record at line ", line);	}
 };
 
-class StartLinearAddressRecordError : IntelHexException {
+class StartLinearAddressRecordError : public IntelHexException {
 public:
 	StartLinearAddressRecordError(uint32_t line)
-	{	ss << "Invalid Start Linear Address Record at line " << line;	}
+	{	message("Invalid Start Linear Address Record at line ", line);	}
 };
 
-class DuplicateStartAddressRecordError : IntelHexException {
+class DuplicateStartAddressRecordError : public IntelHexException {
 public:
 	DuplicateStartAddressRecordError(uint32_t line)
-	{	ss << "Start Address Record appears twice at line " << line;	}
+	{	message("Start Address Record appears twice at line ", line);	}
 };
 
-class InvalidStartAddressValueError : IntelHexException {
+class InvalidStartAddressValueError : public IntelHexException {
 public:
 	InvalidStartAddressValueError()
-	{	ss << "Invalid start address value";	}
+	{	message("Invalid start address value");	}
 };
 
-class EmptyIntelHexError : IntelHexException {
+class EmptyIntelHexError : public IntelHexException {
 public:
 	EmptyIntelHexError()
-	{	ss << "Requested operation cannot be executed with empty object";	}
+	{	message("Requested operation cannot be executed with empty object");	}
 };
+
+class HexFileError : public IntelHexException {
+public:
+	HexFileError()
+	{	message("Hex file can't be opened or read");	}
+};
+
+class MemoryLimitError : public IntelHexException {
+public:
+	MemoryLimitError()
+	{	message("Memory limit exceeded");	}
+	MemoryLimitError(uint32_t line)
+	{	message("Memory limit exceeded at line ", line);	}
+};
+
+class SnapshotError : public IntelHexException {
+public:
+	SnapshotError(const char * reason)
+	{	message("Invalid snapshot file: ", reason);	}
+};
+
+
+// Throw exception which corresponds to error code
+[[noreturn]] inline void throw_hex_error(const HexResult & res)
+{
+	const uint32_t line = res.line;
+	switch (res.error)
+	{
+	case HexError::hex_record:				throw HexRecordError(line);
+	case HexError::record_length:			throw RecordLengthError(line);
+	case HexError::record_type:				throw RecordTypeError(line);
+	case HexError::record_checksum:			throw RecordChecksumError(line);
+	case HexError::address_overlap:			throw AddressOverlapError(res.address, line);
+	case HexError::eof_record:				throw EOFRecordError(line);
+	case HexError::extended_segment_address:	throw ExtendedSegmentAddressRecordError(line);
+	case HexError::extended_linear_address:	throw ExtendedLinearAddressRecordError(line);
+	case HexError::start_segment_address:	throw StartSegmentAddressRecordError(line);
+	case HexError::start_linear_address:	throw StartLinearAddressRecordError(line);
+	case HexError::duplicate_start_address:	throw DuplicateStartAddressRecordError(line);
+	case HexError::io:						throw HexFileError();
+	case HexError::memory_limit:			throw MemoryLimitError(line);
+	case HexError::ok:						break;
+	}
+	throw std::logic_error("throw_hex_error: no error");
+}
@@ -0,0 +1,141 @@
+#include "intelhex_io.h"
+#include <system_error>
+#include <cerrno>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+#if defined(_WIN32)
+
+[[noreturn]] static void throw_last_error(const string & fileName)
+{
+	throw system_error(int(GetLastError()), system_category(), fileName);
+}
+
+MappedFile::MappedFile(const std::string &fileName)
+{
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+							  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw_last_error(fileName);
+
+	LARGE_INTEGER fsize;
+	if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &fsize))
+	{
+		if (fsize.QuadPart > 0)
+		{
+			HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (map)
+			{
+				mapping = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(map);
+			}
+			if (mapping)
+			{
+				ptr = static_cast<const char *>(mapping);
+				length = size_t(fsize.QuadPart);
+			}
+		}
+		if (mapping || fsize.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return;
+		}
+	}
+
+	// pipe or mapping failed: read everything
+	const size_t chunk = 1 << 20;
+	for (DWORD got = 0; ; )
+	{
+		buffer.resize(length + chunk);
+		if (! ReadFile(file, buffer.data() + length, DWORD(chunk), &got, nullptr))
+		{
+			if (GetLastError() == ERROR_BROKEN_PIPE)
+				break;
+			CloseHandle(file);
+			throw_last_error(fileName);
+		}
+		if (got == 0)
+			break;
+		length += got;
+	}
+	CloseHandle(file);
+	buffer.resize(length);
+	ptr = buffer.data();
+}
+
+MappedFile::~MappedFile()
+{
+	if (mapping)
+		UnmapViewOfFile(mapping);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &fileName)
+{
+	const int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw system_error(errno, generic_category(), fileName);
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		if (st.st_size > 0)
+		{
+			void * p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+				mapping = p;
+				ptr = static_cast<const char *>(p);
+				length = size_t(st.st_size);
+			}
+		}
+		if (mapping || st.st_size == 0)
+		{
+			::close(fd);
+			return;
+		}
+	}
+
+	// pipe or mapping failed: read everything
+	const size_t chunk = 1 << 20;
+	while (true)
+	{
+		buffer.resize(length + chunk);
+		const ssize_t got = ::read(fd, buffer.data() + length, chunk);
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			const int err = errno;
+			::close(fd);
+			throw system_error(err, generic_category(), fileName);
+		}
+		if (got == 0)
+			break;
+		length += size_t(got);
+	}
+	::close(fd);
+	buffer.resize(length);
+	ptr = buffer.data();
+}
+
+MappedFile::~MappedFile()
+{
+	if (mapping)
+		munmap(mapping, length);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Read-only view of the whole file contents.
+// Regular files are memory-mapped; pipes and other special files
+// are read into a buffer with large read() calls.
+// Throws std::system_error if file can't be opened or read.
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string & fileName);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	const char * data() const
+	{	return ptr;	}
+	size_t size() const
+	{	return length;	}
+	std::string_view view() const
+	{	return { ptr, length };	}
+
+	bool mapped() const
+	{	return mapping != nullptr;	}
+
+private:
+	const char * ptr = nullptr;
+	size_t length = 0;
+	void * mapping = nullptr;		// start of mapped region, if any
+	std::vector<char> buffer;		// contents of non-mappable file
+};
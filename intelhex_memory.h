@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include "intelhex_exception.h"
+
+
+// Memory accounting hook of IntelHex storage (see IntelHex::set_memory_hook).
+// Every allocation and deallocation of storage blocks and containers is reported.
+class MemoryHook
+{
+public:
+	virtual ~MemoryHook() = default;
+	// Called before size bytes are allocated.
+	// Throw MemoryLimitError to refuse the allocation.
+	virtual void allocate(size_t size) = 0;
+	virtual void deallocate(size_t size) noexcept = 0;
+};
+
+
+// Hook which limits memory of all images it is attached to.
+// Allocation above the limit is refused with MemoryLimitError.
+class MemoryBudget : public MemoryHook
+{
+public:
+	explicit MemoryBudget(size_t limit) : budget(limit) {}
+
+	void allocate(size_t size) override
+	{
+		size_t now = used_bytes.load(std::memory_order_relaxed);
+		do {
+			if (size > budget - now)
+				throw MemoryLimitError();
+		} while (! used_bytes.compare_exchange_weak(now, now + size, std::memory_order_relaxed));
+	}
+	void deallocate(size_t size) noexcept override
+	{	used_bytes.fetch_sub(size, std::memory_order_relaxed);	}
+
+	size_t used() const
+	{	return used_bytes.load(std::memory_order_relaxed);	}
+	size_t limit() const
+	{	return budget;	}
+
+private:
+	const size_t budget;
+	std::atomic<size_t> used_bytes{ 0 };
+};
+
+
+// Memory allocated by storage of an image. Copies of the image share
+// storage blocks, so they share the account too.
+// Memory is taken from upstream resource, it should outlive the image and its copies.
+class MemoryAccount
+{
+public:
+	explicit MemoryAccount(std::shared_ptr<MemoryHook> hook = {},
+						   std::pmr::memory_resource * upstream = std::pmr::get_default_resource())
+		: hook(std::move(hook)), upstream(upstream) {}
+
+	void * allocate(size_t size, size_t align)
+	{
+		if (hook)
+			hook->allocate(size);
+		void * p;
+		try {
+			p = upstream->allocate(size, align);
+		}
+		catch (...)
+		{
+			if (hook)
+				hook->deallocate(size);
+			throw;
+		}
+		const size_t now = current.fetch_add(size, std::memory_order_relaxed) + size;
+		size_t old_peak = peak.load(std::memory_order_relaxed);
+		while (old_peak < now && ! peak.compare_exchange_weak(old_peak, now, std::memory_order_relaxed))
+			;
+		return p;
+	}
+	void deallocate(void * p, size_t size, size_t align) noexcept
+	{
+		upstream->deallocate(p, size, align);
+		current.fetch_sub(size, std::memory_order_relaxed);
+		if (hook)
+			hook->deallocate(size);
+	}
+
+	// Bytes allocated now
+	size_t allocated() const
+	{	return current.load(std::memory_order_relaxed);	}
+	// Maximum of allocated() since creation or reset_peak()
+	size_t peak_allocated() const
+	{	return peak.load(std::memory_order_relaxed);	}
+	void reset_peak()
+	{	peak.store(allocated(), std::memory_order_relaxed);	}
+
+	const std::shared_ptr<MemoryHook> & memory_hook() const
+	{	return hook;	}
+	std::pmr::memory_resource * resource() const
+	{	return upstream;	}
+
+private:
+	const std::shared_ptr<MemoryHook> hook;
+	std::pmr::memory_resource * const upstream;
+	std::atomic<size_t> current{ 0 };
+	std::atomic<size_t> peak{ 0 };
+};
+
+
+// Allocator of storage containers: memory is counted by the account.
+// Account follows the containers on copy, move and swap, so blocks shared
+// between copies are always released to the account they came from.
+// Default-constructed allocator (no account) uses plain operator new.
+template <typename T>
+class AccountAllocator
+{
+public:
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::true_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	AccountAllocator() = default;
+	explicit AccountAllocator(std::shared_ptr<MemoryAccount> account)
+		: account(std::move(account)) {}
+	template <typename U>
+	AccountAllocator(const AccountAllocator<U> & other)
+		: account(other.account) {}
+
+	T * allocate(size_t n)
+	{
+		const size_t size = n * sizeof(T);
+		return static_cast<T *>(account ? account->allocate(size, alignof(T)) : ::operator new(size));
+	}
+	void deallocate(T * p, size_t n) noexcept
+	{
+		if (account)
+			account->deallocate(p, n * sizeof(T), alignof(T));
+		else
+			::operator delete(p);
+	}
+
+	template <typename U>
+	bool operator==(const AccountAllocator<U> & other) const
+	{	return account == other.account;	}
+	template <typename U>
+	bool operator!=(const AccountAllocator<U> & other) const
+	{	return account != other.account;	}
+
+	std::shared_ptr<MemoryAccount> account;
+};
@@ -0,0 +1,325 @@
+#include "intelhex_record.h"
+#include "intelhex_exception.h"
+#include "intelhex_codec.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+
+const HexRecord * HexRecordReader::next(std::string_view s)
+{
+	HexError error;
+	const HexRecord * res = try_next(s, error);
+	if (error != HexError::ok)
+		throw_hex_error({ error, line_no, line_start });
+	return res;
+}
+
+const HexRecord * HexRecordReader::try_next(std::string_view s, HexError &error) noexcept
+{
+	line_no++;
+	line_start = next_line;
+	next_line += s.size() + ((! s.empty() && s.back() == '\n') ? 0 : 1);
+	if (! parse(s, line_no, bin, rec, error))
+		return nullptr;
+	locate(rec);
+	return &rec;
+}
+
+bool HexRecordReader::parse(std::string_view s, uint32_t line, uint8_t *bin, HexRecord &rec)
+{
+	HexError error;
+	const bool res = parse(s, line, bin, rec, error);
+	if (error != HexError::ok)
+		throw_hex_error({ error, line });
+	return res;
+}
+
+bool HexRecordReader::parse(std::string_view s, uint32_t line, uint8_t *bin, HexRecord &rec, HexError &error,
+							bool verify_checksum) noexcept
+{
+	error = HexError::ok;
+	auto fail = [&error](HexError e)
+	{
+		error = e;
+		return false;
+	};
+
+	if (! s.empty() && s.back() == '\n') s.remove_suffix(1);
+	if (! s.empty() && s.back() == '\r') s.remove_suffix(1);
+
+	if (s.empty()) return false;
+
+
+	if (s[0] != ':')
+		return fail(HexError::hex_record);
+
+	const auto hex = s.substr(1);
+	if (hex.length() % 2)
+		return fail(HexError::hex_record);
+
+	// longest possible record: 1 (length) + 2 (address) + 1 (type) + 255 (data) + 1 (crc)
+	const uint32_t length = hex.length() / 2;
+	if (length > 260)
+	{
+		if (! HexCodec::is_hex(hex.data(), hex.length()))
+			return fail(HexError::hex_record);
+		return fail(HexError::record_length);
+	}
+	// decode and compute checksum in one pass
+	uint8_t crc;
+	if (! HexCodec::decode(hex.data(), hex.length(), bin, crc))
+		return fail(HexError::hex_record);
+	if (length < 5)
+		return fail(HexError::hex_record);
+
+	const uint8_t record_length = bin[0];
+	if (length != (5u + record_length))
+		return fail(HexError::record_length);
+
+	const uint16_t addr = bin[1]*256 + bin[2];
+
+	const uint8_t record_type = bin[3];
+	if (record_type > 5)
+		return fail(HexError::record_type);
+
+	if (crc != 0 && verify_checksum)
+		return fail(HexError::record_checksum);
+
+	switch (record_type)
+	{
+	case 1:		// end of file record
+		if (record_length != 0)
+			return fail(HexError::eof_record);
+		break;
+	case 2:		// Extended 8086 Segment Record
+		if (record_length != 2 || addr != 0)
+			return fail(HexError::extended_segment_address);
+		break;
+	case 4:		// Extended Linear Address Record
+		if (record_length != 2 || addr != 0)
+			return fail(HexError::extended_linear_address);
+		break;
+	case 3:		// Start Segment Address Record
+		if (record_length != 4 || addr != 0)
+			return fail(HexError::start_segment_address);
+		break;
+	case 5:		// Start Linear Address Record
+		if (record_length != 4 || addr != 0)
+			return fail(HexError::start_linear_address);
+		break;
+	}
+
+	rec.type = record_type;
+	rec.length = record_length;
+	rec.addr = addr;
+	rec.address = 0;
+	rec.data = bin + 4;
+	rec.line = line;
+	return true;
+}
+
+HexDiagnostic HexRecordReader::diagnose(std::string_view s, uint32_t line, HexError error)
+{
+	if (! s.empty() && s.back() == '\n') s.remove_suffix(1);
+	if (! s.empty() && s.back() == '\r') s.remove_suffix(1);
+
+	HexDiagnostic diag = { line, 1, 0, HexDiagnostic::unknown_type, error };
+	uint8_t header[4];		// length, address, type
+	uint8_t sum;
+	const bool has_header = s.size() >= 9 && s[0] == ':' && HexCodec::decode(s.data() + 1, 8, header, sum);
+	if (has_header)
+		diag.type = header[3];
+
+	switch (error)
+	{
+	case HexError::hex_record:
+		if (! s.empty() && s[0] == ':')
+		{
+			// first non-hex character, or the last one if line is too short or odd
+			size_t pos = 1;
+			while (pos < s.size() && HexCodec::is_hex(&s[pos], 1))
+				pos++;
+			diag.column = uint32_t(min(pos, max<size_t>(s.size() - 1, 1)) + 1);
+		}
+		break;
+	case HexError::record_length:
+		diag.column = 2;
+		break;
+	case HexError::record_type:
+	case HexError::duplicate_start_address:
+		diag.column = 8;
+		break;
+	case HexError::record_checksum:
+		diag.column = uint32_t(s.size() - 1);
+		break;
+	case HexError::address_overlap:
+	case HexError::memory_limit:
+		diag.column = 10;
+		break;
+	case HexError::eof_record:
+	case HexError::extended_segment_address:
+	case HexError::extended_linear_address:
+	case HexError::start_segment_address:
+	case HexError::start_linear_address:
+		{
+			// either length or address field is wrong
+			const uint8_t length = (error == HexError::eof_record) ? 0 :
+								   (error == HexError::start_segment_address ||
+									error == HexError::start_linear_address) ? 4 : 2;
+			diag.column = (has_header && header[0] == length) ? 4 : 2;
+		}
+		break;
+	default:
+		break;
+	}
+	return diag;
+}
+
+void HexRecordReader::locate(HexRecord &rec)
+{
+	const uint8_t * bin = rec.data;
+
+	if (rec.type == 0)
+	{
+		// data record
+		// FIXME: addr should be wrapped
+		// BUT after 02 record (at 64K boundary)
+		// and after 04 record (at 4G boundary)
+		rec.address = rec.addr + offset;
+	}
+	else if (rec.type == 2)
+	{
+		// Extended 8086 Segment Record
+		offset = (bin[0]*256 + bin[1]) * 16;
+	}
+	else if (rec.type == 4)
+	{
+		// Extended Linear Address Record
+		offset = Addr(bin[0]*256 + bin[1]) << 16;
+	}
+}
+
+
+
+HexRecordWriter::HexRecordWriter(std::ostream &file, uint32_t byte_count, Addressing mode) :
+	file(file), byte_count(byte_count), mode(mode), out(64 * 1024)
+{
+	if (byte_count > 255 || byte_count < 1)
+		throw length_error("wrong byte_count value");
+}
+
+void HexRecordWriter::data(Addr addr, const uint8_t *data, size_t len)
+{
+	if (addr < data_end)
+		throw out_of_range("HexRecordWriter: data should be written in ascending address order");
+	const uint64_t end = uint64_t(addr) + len;
+	if (end > (mode == Addressing::linear ? (1ull << 32) : 0x100000ull))
+		throw out_of_range("HexRecordWriter: address is out of range");
+	if (len == 0)
+		return;
+
+	// continue pending record only with contiguous data
+	if (pending_len && addr != uint64_t(pending_addr) + pending_len)
+		flush_pending();
+	data_end = end;
+
+	while (len)
+	{
+		if (pending_len == 0)
+			pending_addr = addr;
+		// records are cut at byte_count and at 64K boundary
+		const uint64_t window_end = (uint64_t(pending_addr) | 0xFFFF) + 1;
+		const uint64_t record_end = min<uint64_t>(uint64_t(pending_addr) + byte_count, window_end);
+		const size_t n = size_t(min<uint64_t>(len, record_end - addr));
+
+		if (pending_len == 0 && addr + n == record_end)
+			write_data_record(addr, data, n);		// whole record, no copy
+		else
+		{
+			memcpy(pending + pending_len, data, n);
+			pending_len += n;
+			if (addr + n == record_end)
+				flush_pending();
+		}
+		addr += Addr(n);
+		data += n;
+		len -= n;
+	}
+}
+
+void HexRecordWriter::start_segment(uint16_t cs, uint16_t ip)
+{
+	flush_pending();
+	const uint8_t bin[4] = {
+		uint8_t(cs >> 8), uint8_t(cs),
+		uint8_t(ip >> 8), uint8_t(ip) };
+	record(3, 0, bin, 4);
+}
+
+void HexRecordWriter::start_linear(uint32_t eip)
+{
+	flush_pending();
+	const uint8_t bin[4] = {
+		uint8_t(eip >> 24), uint8_t(eip >> 16),
+		uint8_t(eip >>  8), uint8_t(eip >>  0) };
+	record(5, 0, bin, 4);
+}
+
+void HexRecordWriter::finish()
+{
+	flush_pending();
+	record(1, 0, nullptr, 0);
+	flush();
+	file.flush();
+}
+
+void HexRecordWriter::write_data_record(Addr addr, const uint8_t *data, size_t len)
+{
+	const uint16_t high = addr >> 16;
+	if (offset != high)
+	{
+		// Extended Linear Address Record holds upper 16 bits of address,
+		// Extended Segment Address Record holds segment (address / 16)
+		const uint16_t value = (mode == Addressing::linear) ? high : uint16_t(high << 12);
+		const uint8_t bin[2] = {
+			uint8_t(value >> 8),	// msb
+			uint8_t(value) };		// lsb
+		record(mode == Addressing::linear ? 4 : 2, 0, bin, 2);
+		offset = high;
+	}
+	record(0, uint16_t(addr), data, uint8_t(len));
+}
+
+void HexRecordWriter::flush_pending()
+{
+	if (pending_len == 0)
+		return;
+	write_data_record(pending_addr, pending, pending_len);
+	pending_len = 0;
+}
+
+// Format record in place, the stream is written only when buffer is full.
+void HexRecordWriter::record(uint8_t type, uint16_t addr, const uint8_t *data, uint8_t len)
+{
+	if (out.size() - out_pos < max_record)
+		flush();
+	const uint8_t header[4] = { len, uint8_t(addr >> 8), uint8_t(addr), type };
+	char * p = &out[out_pos];
+	*p++ = ':';
+	uint8_t sum = HexCodec::encode(header, sizeof(header), p);
+	sum += HexCodec::encode(data, len, p + 8);
+	p += 8 + 2 * len;
+	const uint8_t chksum = -sum;
+	HexCodec::encode(&chksum, 1, p);
+	p[2] = '\n';
+	out_pos = p + 3 - out.data();
+}
+
+void HexRecordWriter::flush()
+{
+	file.write(out.data(), out_pos);
+	out_pos = 0;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "intelhex_exception.h"
+
+
+// One record of HEX file after syntax check
+struct HexRecord
+{
+	uint8_t type;
+	uint8_t length;			// length of data
+	uint16_t addr;			// address field of the record
+	uint32_t address;		// absolute address of data record (02/04 offsets applied)
+	const uint8_t * data;	// record data, valid until the next record is decoded
+	uint32_t line;			// line number, starting from 1
+};
+
+
+// Streaming HEX reader.
+// Records are decoded one by one and passed to the caller, nothing is stored,
+// so any file is read with a small fixed working set.
+// Syntax errors are thrown as IntelHex exceptions (see intelhex_exception.h),
+// try_next() reports them as error codes.
+class HexRecordReader
+{
+public:
+	using Addr = uint32_t;
+
+	// Call f(const HexRecord &) for every record of the stream. Empty lines are skipped.
+	template <typename F>
+	void read(std::istream & file, F f)
+	{
+		for (std::string s; std::getline(file, s); )
+			if (const HexRecord * rec = next(s))
+				f(*rec);
+	}
+
+	// The same for HEX text in memory.
+	template <typename F>
+	void read(std::string_view text, F f)
+	{
+		while (! text.empty())
+		{
+			const auto eol = text.find('\n');
+			if (const HexRecord * rec = next(text.substr(0, eol)))
+				f(*rec);
+			if (eol == text.npos)
+				break;
+			text.remove_prefix(eol + 1);
+		}
+	}
+
+	// Decode next line of the file.
+	// @return nullptr   if line is empty.
+	const HexRecord * next(std::string_view s);
+	// The same without exceptions: error is set, nullptr is returned.
+	const HexRecord * try_next(std::string_view s, HexError & error) noexcept;
+
+	// Number of lines passed so far
+	uint32_t line() const
+	{	return line_no;	}
+	// Byte offset of the last line passed to next()
+	uint64_t line_offset() const
+	{	return line_start;	}
+
+	// Start a new file: line numbers and address offset are reset
+	void reset()
+	{	line_no = 0; line_start = next_line = 0; offset = 0;	}
+
+	// Check syntax of one record, decode it into bin buffer.
+	// This part of decoding doesn't depend on preceding records,
+	// rec.address is not set.
+	// @param  bin     buffer for at least 260 bytes, rec.data points into it.
+	// @return false   if line is empty.
+	static bool parse(std::string_view s, uint32_t line, uint8_t * bin, HexRecord & rec);
+	// The same without exceptions: on error returns false with error set.
+	// Checksum is not verified if verify_checksum is false.
+	static bool parse(std::string_view s, uint32_t line, uint8_t * bin, HexRecord & rec, HexError & error,
+					  bool verify_checksum = true) noexcept;
+
+	// Find position of the error in the line and record type, if it can be decoded.
+	// Error path only: the line is scanned again.
+	static HexDiagnostic diagnose(std::string_view s, uint32_t line, HexError error);
+
+	// Follow address records (02, 04) and set absolute address of data records.
+	// Records should be passed in file order.
+	void locate(HexRecord & rec);
+
+private:
+	uint8_t bin[260];
+	HexRecord rec;
+	uint32_t line_no = 0;
+	uint64_t line_start = 0;
+	uint64_t next_line = 0;
+	Addr offset = 0;
+};
+
+
+
+// Streaming HEX writer.
+// Data is passed by chunks in ascending address order. Contiguous chunks are
+// joined into records of byte_count bytes, records never cross 64K boundary,
+// extended address records are inserted when the upper address part changes.
+// Only one record is kept in memory, output goes to the stream by big blocks.
+class HexRecordWriter
+{
+public:
+	using Addr = uint32_t;
+
+	enum class Addressing {
+		linear,			// Extended Linear Address Records (04), full 32-bit range
+		segmented,		// Extended Segment Address Records (02), addresses below 1M
+	};
+
+	HexRecordWriter(std::ostream & file, uint32_t byte_count = 16, Addressing mode = Addressing::linear);
+
+	// Write len bytes at addr. Address should not be below the end of previous data.
+	void data(Addr addr, const uint8_t * data, size_t len);
+
+	// Start Segment Address Record (03)
+	void start_segment(uint16_t cs, uint16_t ip);
+	// Start Linear Address Record (05)
+	void start_linear(uint32_t eip);
+
+	// Write extended address record before the next data record even if
+	// data lies in the first 64K or the upper address part is not changed.
+	void force_address_record()
+	{	offset.reset();	}
+
+	// Write pending data and End Of File record, flush output.
+	// Nothing is written by destructor, so finish() should always be called.
+	void finish();
+
+private:
+	// ':' + 5 header/checksum bytes + 255 data bytes + newline
+	static constexpr size_t max_record = 1 + 2 * (5 + 255) + 1;
+
+	std::ostream & file;
+	const uint32_t byte_count;
+	const Addressing mode;
+
+	std::vector<char> out;		// output buffer
+	size_t out_pos = 0;
+
+	std::optional<uint16_t> offset = 0;	// upper 16 bits of address of last data record
+
+	// data record which may be continued by next chunk
+	uint8_t pending[255];
+	size_t pending_len = 0;
+	Addr pending_addr = 0;
+	uint64_t data_end = 0;		// end of data written so far
+
+	void write_data_record(Addr addr, const uint8_t * data, size_t len);
+	void flush_pending();
+	void record(uint8_t type, uint16_t addr, const uint8_t * data, uint8_t len);
+	void flush();
+};
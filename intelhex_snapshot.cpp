@@ -0,0 +1,167 @@
+#include "intelhex_snapshot.h"
+#include "intelhex_exception.h"
+#include <cstring>
+
+using namespace std;
+
+
+namespace {
+
+const char magic[8] = { 'I', 'H', 'E', 'X', 'S', 'N', 'A', 'P' };
+const uint32_t version = 1;
+const size_t header_size = 64;
+const size_t entry_size = 16;
+const size_t checksum_offset = 60;
+const size_t payload_align = 64;
+
+enum StartType : uint8_t {
+	start_none, start_segmented, start_linear
+};
+
+void put16(uint8_t * p, uint16_t v)
+{	p[0] = uint8_t(v); p[1] = uint8_t(v >> 8);	}
+void put32(uint8_t * p, uint32_t v)
+{	put16(p, uint16_t(v)); put16(p + 2, uint16_t(v >> 16));	}
+void put64(uint8_t * p, uint64_t v)
+{	put32(p, uint32_t(v)); put32(p + 4, uint32_t(v >> 32));	}
+
+uint16_t get16(const uint8_t * p)
+{	return uint16_t(p[0] | p[1] << 8);	}
+uint32_t get32(const uint8_t * p)
+{	return get16(p) | uint32_t(get16(p + 2)) << 16;	}
+uint64_t get64(const uint8_t * p)
+{	return get32(p) | uint64_t(get32(p + 4)) << 32;	}
+
+uint32_t fnv1a(uint32_t hash, const uint8_t * p, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ p[i]) * 16777619u;
+	return hash;
+}
+const uint32_t fnv_basis = 2166136261u;
+
+bool all_zero(const uint8_t * p, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		if (p[i])
+			return false;
+	return true;
+}
+
+}
+
+
+void HexSnapshot::write(ostream &file, const IntelHex &ih)
+{
+	const auto segments = ih.segments();
+	vector<uint8_t> table(segments.size() * entry_size);
+	uint64_t payload = 0;
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		const auto & seg = segments[i];
+		// end of the last segment wraps to 0 at 4G
+		const uint64_t length = (uint64_t(seg.end) ? uint64_t(seg.end) : (1ull << 32)) - seg.begin;
+		put32(&table[i * entry_size], seg.begin);
+		put64(&table[i * entry_size + 8], length);
+		payload += length;
+	}
+
+	uint8_t header[header_size] = {};
+	memcpy(header, magic, sizeof(magic));
+	put32(header + 8, version);
+	put32(header + 12, uint32_t(segments.size()));
+	const uint64_t payload_offset = (header_size + table.size() + payload_align - 1) / payload_align * payload_align;
+	put64(header + 16, payload_offset);
+	put64(header + 24, payload);
+	if (ih.start_addr.has_value())
+	{
+		if (auto seg = get_if<IntelHex::StartAddrSegmented>(&ih.start_addr.value()))
+		{
+			header[32] = start_segmented;
+			put32(header + 36, uint32_t(seg->CS) << 16 | seg->IP);
+		}
+		else
+		{
+			header[32] = start_linear;
+			put32(header + 36, get<IntelHex::StartAddrExtended>(ih.start_addr.value()).EIP);
+		}
+	}
+	header[33] = ih.padding;
+	put32(header + checksum_offset, fnv1a(fnv1a(fnv_basis, header, checksum_offset), table.data(), table.size()));
+
+	file.write(reinterpret_cast<const char *>(header), header_size);
+	file.write(reinterpret_cast<const char *>(table.data()), streamsize(table.size()));
+	const char zeros[payload_align] = {};
+	file.write(zeros, streamsize(payload_offset - header_size - table.size()));
+
+	// payload by big chunks
+	vector<uint8_t> chunk(1 << 20);
+	for (auto & seg : segments)
+	{
+		uint64_t length = (uint64_t(seg.end) ? uint64_t(seg.end) : (1ull << 32)) - seg.begin;
+		for (Addr addr = seg.begin; length; )
+		{
+			const size_t n = size_t(min<uint64_t>(length, chunk.size()));
+			ih.tobinbuffer(addr, chunk.data(), n);
+			file.write(reinterpret_cast<const char *>(chunk.data()), streamsize(n));
+			addr += Addr(n);
+			length -= n;
+		}
+	}
+}
+
+HexSnapshot::HexSnapshot(const string &fileName)
+	: file(fileName)
+{
+	const auto data = reinterpret_cast<const uint8_t *>(file.data());
+	const size_t size = file.size();
+
+	if (size < header_size || memcmp(data, magic, sizeof(magic)) != 0)
+		throw SnapshotError("not a snapshot file");
+	if (get32(data + 8) != version)
+		throw SnapshotError("unsupported version");
+
+	const uint32_t count = get32(data + 12);
+	const uint64_t payload_offset = get64(data + 16);
+	payload_size = size_t(get64(data + 24));
+	const uint64_t table_end = header_size + uint64_t(count) * entry_size;
+	if (table_end > payload_offset || payload_offset > size || size - payload_offset != payload_size)
+		throw SnapshotError("file is truncated or has wrong size");
+
+	const uint8_t * table = data + header_size;
+	if (get32(data + checksum_offset) != fnv1a(fnv1a(fnv_basis, data, checksum_offset), table, count * entry_size))
+		throw SnapshotError("header checksum mismatch");
+	if (data[34] || data[35] || ! all_zero(data + 40, 20))
+		throw SnapshotError("reserved fields are not zero");
+
+	pad = data[33];
+	const uint32_t start_value = get32(data + 36);
+	switch (data[32])
+	{
+	case start_none:		break;
+	case start_segmented:	start = IntelHex::StartAddrSegmented{ uint16_t(start_value >> 16), uint16_t(start_value) };	break;
+	case start_linear:		start = IntelHex::StartAddrExtended{ start_value };	break;
+	default:
+		throw SnapshotError("bad start address type");
+	}
+
+	// segments should be sorted, not overlapped and fill the payload exactly
+	segs.reserve(count);
+	const uint8_t * payload = data + payload_offset;
+	uint64_t used = 0;
+	uint64_t prev_end = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const uint8_t * e = table + i * entry_size;
+		const Addr begin = get32(e);
+		const uint64_t length = get64(e + 8);
+		if (get32(e + 4) != 0 || length == 0 || begin + length > (1ull << 32)
+			|| (i && begin < prev_end) || length > payload_size - used)
+			throw SnapshotError("bad segment table");
+		segs.push_back({ begin, size_t(length), payload + used });
+		used += length;
+		prev_end = begin + length;
+	}
+	if (used != payload_size)
+		throw SnapshotError("bad segment table");
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "intelhex.h"
+#include "intelhex_io.h"
+
+
+// Binary snapshot of IntelHex image (IntelHex::save_snapshot / load_snapshot).
+// Loading of a snapshot is a check of the header and segment table,
+// data is used straight from the memory-mapped file.
+//
+// File layout, all numbers are little-endian:
+//   0   char[8]  magic "IHEXSNAP"
+//   8   u32      version (1)
+//   12  u32      number of segments
+//   16  u64      payload offset from the file start (multiple of 64)
+//   24  u64      payload size
+//   32  u8       start address type: 0 - none, 1 - segmented (CS:IP), 2 - linear (EIP)
+//   33  u8       padding
+//   34  u16      reserved, 0
+//   36  u32      start address: CS << 16 | IP, or EIP
+//   40  u8[20]   reserved, 0
+//   60  u32      FNV-1a checksum of bytes 0..59 and the segment table
+//   64  segment table: u32 address, u32 reserved (0), u64 length
+//   payload: data of all segments in table order, without gaps
+// Payload itself is not checksummed: file size and segment lengths should match.
+class HexSnapshot
+{
+public:
+	using Addr = IntelHex::Addr;
+
+	// Throws SnapshotError if file is not a valid snapshot,
+	// std::system_error if it can't be opened.
+	explicit HexSnapshot(const std::string & fileName);
+
+	struct Segment {
+		Addr begin;
+		size_t length;
+		const uint8_t * data;		// points into the mapped file
+	};
+	const std::vector<Segment> & segments() const
+	{	return segs;	}
+
+	// Total number of data bytes
+	size_t size() const
+	{	return payload_size;	}
+
+	uint8_t padding() const
+	{	return pad;	}
+	const IntelHex::StartAddr & start_addr() const
+	{	return start;	}
+
+	// Write snapshot of the image
+	static void write(std::ostream & file, const IntelHex & ih);
+
+private:
+	MappedFile file;
+	std::vector<Segment> segs;
+	size_t payload_size = 0;
+	uint8_t pad = 0xFF;
+	IntelHex::StartAddr start;
+};
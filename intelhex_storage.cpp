@@ -0,0 +1,267 @@
+#include "intelhex_storage.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+const uint8_t * ExtentStorage::find(Addr addr) const
+{
+	auto it = extents.upper_bound(addr);
+	if (it == extents.begin())
+		return nullptr;
+	--it;
+	const uint64_t ofs = addr - it->first;
+	if (ofs >= it->second->size())
+		return nullptr;
+	return it->second->data() + ofs;
+}
+
+void SegmentIndex::add(Addr addr, size_t len)
+{
+	if (len == 0)
+		return;
+	const uint64_t to_wrap = (1ull << 32) - addr;
+	if (len <= to_wrap)
+		return add_range(addr, Addr(addr + len - 1));
+	add_range(addr, 0xFFFFFFFF);
+	add_range(0, Addr(len - to_wrap - 1));
+}
+
+void SegmentIndex::add_range(Addr first, Addr last)
+{
+	auto next = segs.upper_bound(first);
+
+	// segment which contains first or ends right before it
+	auto it = segs.end();
+	if (next != segs.begin())
+	{
+		auto prev = std::prev(next);
+		if (uint64_t(prev->second) + 1 >= first)
+			it = prev;
+	}
+	if (it == segs.end())
+		it = segs.emplace_hint(next, first, last);
+	else
+		it->second = max(it->second, last);
+
+	// absorb following segments which are overlapped or touched
+	while (next != segs.end() && next->first <= uint64_t(it->second) + 1)
+	{
+		it->second = max(it->second, next->second);
+		next = segs.erase(next);
+	}
+}
+
+void SegmentIndex::remove(Addr addr)
+{
+	auto it = segs.upper_bound(addr);
+	if (it == segs.begin())
+		return;
+	--it;
+	const Addr last = it->second;
+	if (last < addr)
+		return;
+
+	if (it->first == addr)
+	{
+		if (addr == last)
+			segs.erase(it);
+		else
+		{
+			// move segment start to the next byte
+			// (not by extract(): node handles of some libstdc++ versions
+			// leak a copy of the allocator)
+			segs.emplace_hint(std::next(it), addr + 1, last);
+			segs.erase(it);
+		}
+	}
+	else
+	{
+		if (addr != last)		// split segment in two
+			segs.emplace_hint(std::next(it), addr + 1, last);
+		it->second = addr - 1;
+	}
+}
+
+SegmentIndex::OptionalAddr SegmentIndex::find_used(Addr addr, size_t len) const
+{
+	const uint64_t to_wrap = (1ull << 32) - addr;
+	if (len <= to_wrap)
+		return find_used_nowrap(addr, len);
+
+	if (auto used = find_used_nowrap(addr, to_wrap))
+		return used;
+	return find_used_nowrap(0, len - to_wrap);
+}
+
+SegmentIndex::OptionalAddr SegmentIndex::segment_last(Addr addr) const
+{
+	auto it = segs.upper_bound(addr);
+	if (it == segs.begin() || std::prev(it)->second < addr)
+		return {};
+	return std::prev(it)->second;
+}
+
+SegmentIndex::OptionalAddr SegmentIndex::find_used_nowrap(Addr addr, size_t len) const
+{
+	if (len == 0)
+		return {};
+	auto it = segs.upper_bound(addr);
+	if (it != segs.begin() && std::prev(it)->second >= addr)
+		return addr;
+	if (it != segs.end() && it->first < uint64_t(addr) + len)
+		return it->first;
+	return {};
+}
+
+
+void ExtentStorage::write(Addr addr, const uint8_t *data, size_t len)
+{
+	const size_t old_count = count;
+	const Addr first = addr;
+	const size_t total = len;
+	while (len)
+	{
+		// split data on block boundaries
+		const uint64_t block_end = (uint64_t(addr) | (block_size - 1)) + 1;
+		const size_t n = size_t(min<uint64_t>(len, block_end - addr));
+		write_block(addr, data, n);
+		addr += n;		// wraps at 4G
+		data += n;
+		len -= n;
+	}
+	if (count != old_count)		// index is unchanged if all bytes were overwritten
+		index.add(first, total);
+}
+
+// Write data which lies inside one block.
+void ExtentStorage::write_block(Addr addr, const uint8_t *data, size_t len)
+{
+	const Addr block_begin = addr & ~(block_size - 1);
+	const uint64_t block_end = uint64_t(block_begin) + block_size;
+	const uint64_t end = uint64_t(addr) + len;
+
+	auto next = extents.upper_bound(addr);
+
+	// extent which contains addr or ends right before it
+	auto it = extents.end();
+	if (next != extents.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first >= block_begin && end_of(*prev) >= addr)
+			it = prev;
+	}
+	if (it == extents.end())
+		it = extents.emplace_hint(next, addr, std::allocate_shared<Extent>(alloc, alloc));
+
+	Extent & ext = unshare(it->second, alloc);
+	const Addr base = it->first;
+
+	// all memory is allocated before any change: if allocation fails
+	// (e.g. refused by memory hook), storage is left as it was
+	uint64_t joined_end = end;
+	for (auto n = next; n != extents.end() && n->first <= end && n->first < block_end; ++n)
+		joined_end = max(joined_end, end_of(*n));
+	const size_t need = size_t(joined_end - base);
+	if (need > ext.capacity())		// grow, but never past block end
+	{
+		try {
+			ext.reserve(min<uint64_t>(max(need, 2 * ext.capacity()), block_end - base));
+		}
+		catch (...)
+		{
+			if (ext.empty())
+				extents.erase(it);
+			throw;
+		}
+	}
+
+	count -= ext.size();
+	if (base + ext.size() < end)
+		ext.resize(end - base);
+	memcpy(ext.data() + (addr - base), data, len);
+
+	// absorb following extents which are overlapped or touched by new data
+	while (next != extents.end() && next->first <= end && next->first < block_end)
+	{
+		const uint64_t next_end = end_of(*next);
+		const Extent & absorbed = *next->second;
+		count -= absorbed.size();
+		if (next_end > end)
+			ext.insert(ext.end(), absorbed.end() - (next_end - end), absorbed.end());
+		next = extents.erase(next);
+	}
+
+	count += ext.size();
+}
+
+bool ExtentStorage::erase(Addr addr)
+{
+	auto it = extents.upper_bound(addr);
+	if (it == extents.begin())
+		return false;
+	--it;
+	const size_t ofs = addr - it->first;
+	if (ofs >= it->second->size())
+		return false;
+
+	Extent & ext = unshare(it->second, alloc);
+	count--;
+	index.remove(addr);
+	if (ext.size() == 1)
+		extents.erase(it);
+	else if (ofs == ext.size() - 1)
+		ext.pop_back();
+	else if (ofs == 0)
+	{
+		// move extent start to the next byte, see SegmentIndex::remove()
+		extents.emplace_hint(std::next(it), addr + 1, it->second);
+		extents.erase(it);
+		ext.erase(ext.begin());
+	}
+	else
+	{
+		// split extent in two
+		auto tail = std::allocate_shared<Extent>(alloc, ext.begin() + ofs + 1, ext.end(), alloc);
+		extents.emplace_hint(std::next(it), addr + 1, std::move(tail));
+		ext.resize(ofs);
+	}
+	return true;
+}
+
+ExtentStorage::OptionalAddr ExtentStorage::find_used(Addr addr, size_t len) const
+{
+	const uint64_t to_wrap = (1ull << 32) - addr;
+	if (len <= to_wrap)
+		return find_used_nowrap(addr, len);
+
+	if (auto used = find_used_nowrap(addr, to_wrap))
+		return used;
+	return find_used_nowrap(0, len - to_wrap);
+}
+
+ExtentStorage::OptionalAddr ExtentStorage::find_used_nowrap(Addr addr, size_t len) const
+{
+	if (len == 0)
+		return {};
+	auto it = extents.upper_bound(addr);
+	if (it != extents.begin() && end_of(*std::prev(it)) > addr)
+		return addr;
+	if (it != extents.end() && it->first < uint64_t(addr) + len)
+		return it->first;
+	return {};
+}
+
+ExtentStorage::OptionalAddr ExtentStorage::min_addr() const
+{
+	if (extents.empty()) return {};
+	return extents.begin()->first;
+}
+
+ExtentStorage::OptionalAddr ExtentStorage::max_addr() const
+{
+	if (extents.empty()) return {};
+	auto & last = *extents.rbegin();
+	return Addr(last.first + last.second->size() - 1);
+}
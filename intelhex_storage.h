@@ -0,0 +1,497 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "intelhex_memory.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+// Sorted set of contiguous address ranges, kept by storage in sync with its content.
+// Neighbouring ranges are always joined, so every entry is one segment of data.
+class SegmentIndex
+{
+public:
+	using Addr = uint32_t;
+	using OptionalAddr = std::optional<Addr>;
+
+	explicit SegmentIndex(const AccountAllocator<uint8_t> & alloc = {})
+		: segs(alloc) {}
+
+	// Mark len bytes starting at addr as used. Address wraps at 4G boundary.
+	void add(Addr addr, size_t len);
+	// Mark byte at addr as unused.
+	void remove(Addr addr);
+
+	// First used address among len bytes starting at addr (with 4G wrap).
+	OptionalAddr find_used(Addr addr, size_t len) const;
+	// Last address of the segment which contains addr.
+	OptionalAddr segment_last(Addr addr) const;
+
+	void clear()
+	{	segs.clear();	}
+	size_t count() const
+	{	return segs.size();	}
+
+	OptionalAddr min_addr() const
+	{	return segs.empty() ? OptionalAddr() : segs.begin()->first;	}
+	OptionalAddr max_addr() const
+	{	return segs.empty() ? OptionalAddr() : segs.rbegin()->second;	}
+
+	// Call f(first, last) for every segment in ascending address order.
+	// Both addresses are inclusive.
+	template <typename F>
+	void for_each(F f) const
+	{
+		for (auto & s : segs)
+			f(s.first, s.second);
+	}
+
+private:
+	std::map<Addr, Addr, std::less<Addr>, AccountAllocator<std::pair<const Addr, Addr>>> segs;		// first -> last address
+
+	void add_range(Addr first, Addr last);
+	OptionalAddr find_used_nowrap(Addr addr, size_t len) const;
+};
+
+
+// Storage blocks are shared between copies (copy-on-write):
+// a block is cloned before modification if some other copy uses it.
+template <typename T, typename Alloc>
+T & unshare(std::shared_ptr<T> & p, const Alloc & alloc)
+{
+	if (p.use_count() > 1)
+		p = std::allocate_shared<T>(alloc, *p);
+	return *p;
+}
+
+
+// Sparse byte storage used by IntelHex.
+// Contiguous runs of data are kept as extents: start address plus
+// a contiguous byte vector. Extents never cross a block_size boundary,
+// so joining/splitting an extent costs at most block_size bytes.
+// Copy of the storage shares extents, so it costs O(number of extents)
+// and modification of a copy clones only the touched extents.
+// All memory is allocated through the memory account of the storage.
+class ExtentStorage
+{
+public:
+	using Addr = uint32_t;
+	using OptionalAddr = std::optional<Addr>;
+
+	static constexpr Addr block_size = 0x1000;
+
+	ExtentStorage()
+		: ExtentStorage(std::make_shared<MemoryAccount>()) {}
+	explicit ExtentStorage(std::shared_ptr<MemoryAccount> account)
+		: alloc(std::move(account)), extents(alloc), index(alloc) {}
+
+	// Account of the storage, shared with its copies
+	MemoryAccount * memory_account() const
+	{	return alloc.account.get();	}
+	// Allocator of the storage, memory of scratch buffers is counted by the same account
+	const AccountAllocator<uint8_t> & allocator() const
+	{	return alloc;	}
+	// Number of extents
+	size_t block_count() const
+	{	return extents.size();	}
+
+	// Pointer to byte at address, nullptr if address is not used.
+	const uint8_t * find(Addr addr) const;
+
+	void set(Addr addr, uint8_t value)
+	{	write(addr, &value, 1);	}
+
+	// Store len bytes starting at addr, overwriting existing data.
+	// Address wraps at 4G boundary.
+	void write(Addr addr, const uint8_t * data, size_t len);
+
+	// Remove byte at address. Returns false if it was not used.
+	bool erase(Addr addr);
+
+	// First used address among len bytes starting at addr (with 4G wrap).
+	OptionalAddr find_used(Addr addr, size_t len) const;
+
+	void clear()
+	{	extents.clear(); index.clear(); count = 0;	}
+
+	size_t size() const
+	{	return count;	}
+	bool empty() const
+	{	return count == 0;	}
+
+	OptionalAddr min_addr() const;
+	OptionalAddr max_addr() const;
+
+	// Contiguous segments of data, see SegmentIndex::for_each()
+	template <typename F>
+	void for_each_segment(F f) const
+	{	index.for_each(f);	}
+	size_t segment_count() const
+	{	return index.count();	}
+	OptionalAddr segment_last(Addr addr) const
+	{	return index.segment_last(addr);	}
+
+	// Call f(addr, data, len) for every extent in ascending address order.
+	// Adjacent extents may be contiguous (they are split at block boundaries).
+	template <typename F>
+	void for_each_run(F f) const
+	{
+		for (auto & e : extents)
+			f(e.first, e.second->data(), e.second->size());
+	}
+
+	// The same, for runs clipped to address range [first, last].
+	template <typename F>
+	void for_each_run(Addr first, Addr last, F f) const
+	{
+		auto it = extents.upper_bound(first);
+		if (it != extents.begin() && end_of(*std::prev(it)) > first)
+			--it;
+		for ( ; it != extents.end() && it->first <= last; ++it)
+		{
+			const Addr begin = std::max(it->first, first);
+			const uint64_t end = std::min<uint64_t>(end_of(*it), uint64_t(last) + 1);
+			f(begin, it->second->data() + (begin - it->first), size_t(end - begin));
+		}
+	}
+
+private:
+	using Alloc = AccountAllocator<uint8_t>;
+	using Extent = std::vector<uint8_t, Alloc>;
+	Alloc alloc;
+	std::map<Addr, std::shared_ptr<Extent>, std::less<Addr>, AccountAllocator<std::pair<const Addr, std::shared_ptr<Extent>>>> extents;
+	SegmentIndex index;
+	size_t count = 0;
+
+	void write_block(Addr addr, const uint8_t * data, size_t len);
+	OptionalAddr find_used_nowrap(Addr addr, size_t len) const;
+
+	static uint64_t end_of(const std::pair<const Addr, std::shared_ptr<Extent>> & e)
+	{	return uint64_t(e.first) + e.second->size();	}
+};
+
+
+
+// Sparse byte storage which splits 32-bit address space into fixed-size pages.
+// Pages are allocated lazily, used bytes of a page are tracked by a bitmap.
+// Access to a single address is O(1): two-level page directory, no search.
+// PageSize should be a power of two, e.g. flash sector size of the target.
+// Pages and page tables are shared between copies, see unshare().
+// All memory is allocated through the memory account of the storage.
+template <size_t PageSize = 0x1000>
+class PagedStorage
+{
+	static_assert(PageSize >= 64 && PageSize <= 0x10000 && (PageSize & (PageSize - 1)) == 0,
+				  "PageSize should be a power of two in range 64..64K");
+public:
+	using Addr = uint32_t;
+	using OptionalAddr = std::optional<Addr>;
+
+	static constexpr Addr page_size = PageSize;
+
+	PagedStorage()
+		: PagedStorage(std::make_shared<MemoryAccount>()) {}
+	explicit PagedStorage(std::shared_ptr<MemoryAccount> account)
+		: alloc(std::move(account)), dir(alloc), index(alloc) {}
+
+	// Account of the storage, shared with its copies
+	MemoryAccount * memory_account() const
+	{	return alloc.account.get();	}
+	// Allocator of the storage, memory of scratch buffers is counted by the same account
+	const AccountAllocator<uint8_t> & allocator() const
+	{	return alloc;	}
+	// Number of allocated pages
+	size_t block_count() const
+	{
+		size_t n = 0;
+		for_each_page([&n](Addr, const Page &) {	n++; return true;	});
+		return n;
+	}
+
+	const uint8_t * find(Addr addr) const
+	{
+		const Page * page = get_page(addr >> page_bits);
+		const Addr ofs = addr & page_mask;
+		return (page && page->test(ofs)) ? &page->data[ofs] : nullptr;
+	}
+
+	void set(Addr addr, uint8_t value)
+	{
+		Page & page = make_page(addr >> page_bits);
+		const Addr ofs = addr & page_mask;
+		page.data[ofs] = value;
+		if (! page.test(ofs))
+		{
+			page.used[ofs / 64] |= bit(ofs);
+			page.count++;
+			count++;
+			index.add(addr, 1);
+		}
+	}
+
+	// Store len bytes starting at addr, overwriting existing data.
+	// Address wraps at 4G boundary.
+	void write(Addr addr, const uint8_t * data, size_t len)
+	{
+		while (len)
+		{
+			const Addr ofs = addr & page_mask;
+			const size_t n = std::min<size_t>(len, PageSize - ofs);
+			Page & page = make_page(addr >> page_bits);
+			std::memcpy(page.data + ofs, data, n);
+			const size_t added = page.mark(ofs, n);
+			page.count += added;
+			count += added;
+			if (added)
+				index.add(addr, n);
+			addr += Addr(n);	// wraps at 4G
+			data += n;
+			len -= n;
+		}
+	}
+
+	// Remove byte at address. Returns false if it was not used.
+	bool erase(Addr addr)
+	{
+		const Addr pgn = addr >> page_bits;
+		const Page * shared = get_page(pgn);
+		const Addr ofs = addr & page_mask;
+		if (! shared || ! shared->test(ofs))
+			return false;
+		auto & slot = unshare(dir[pgn >> l2_bits], alloc)[pgn & l2_mask];
+		Page & page = unshare(slot, alloc);
+		page.used[ofs / 64] &= ~bit(ofs);
+		count--;
+		index.remove(addr);
+		if (--page.count == 0)
+			slot.reset();
+		return true;
+	}
+
+	// First used address among len bytes starting at addr (with 4G wrap).
+	OptionalAddr find_used(Addr addr, size_t len) const
+	{
+		while (len)
+		{
+			const Addr ofs = addr & page_mask;
+			const size_t n = std::min<size_t>(len, PageSize - ofs);
+			if (const Page * page = get_page(addr >> page_bits))
+			{
+				const size_t first = page->find_set(ofs, ofs + n);
+				if (first < ofs + n)
+					return Addr((addr & ~page_mask) + first);
+			}
+			addr += Addr(n);
+			len -= n;
+		}
+		return {};
+	}
+
+	void clear()
+	{	dir.clear(); dir.shrink_to_fit(); index.clear(); count = 0;	}
+
+	size_t size() const
+	{	return count;	}
+	bool empty() const
+	{	return count == 0;	}
+
+	OptionalAddr min_addr() const
+	{	return index.min_addr();	}
+	OptionalAddr max_addr() const
+	{	return index.max_addr();	}
+
+	// Contiguous segments of data, see SegmentIndex::for_each()
+	template <typename F>
+	void for_each_segment(F f) const
+	{	index.for_each(f);	}
+	size_t segment_count() const
+	{	return index.count();	}
+	OptionalAddr segment_last(Addr addr) const
+	{	return index.segment_last(addr);	}
+
+	// Call f(addr, data, len) for every run of used bytes in ascending address order.
+	// Runs are split at page boundaries.
+	template <typename F>
+	void for_each_run(F f) const
+	{
+		for_each_page([&f](Addr base, const Page & page)
+		{
+			page.for_each_run(base, 0, PageSize, f);
+			return true;
+		});
+	}
+
+	// The same, for runs clipped to address range [first, last].
+	template <typename F>
+	void for_each_run(Addr first, Addr last, F f) const
+	{
+		const Addr first_page = first >> page_bits;
+		const Addr last_page = last >> page_bits;
+		for (uint64_t pgn = first_page; pgn <= last_page; pgn++)
+		{
+			const size_t i = size_t(pgn >> l2_bits);
+			if (i >= dir.size())
+				break;
+			if (! dir[i])
+			{
+				pgn |= l2_mask;		// skip whole table
+				continue;
+			}
+			if (const Page * page = (*dir[i])[pgn & l2_mask].get())
+			{
+				const size_t from = (pgn == first_page) ? (first & page_mask) : 0;
+				const size_t to = (pgn == last_page) ? (last & page_mask) + 1 : PageSize;
+				page->for_each_run(Addr(pgn << page_bits), from, to, f);
+			}
+		}
+	}
+
+private:
+	static constexpr unsigned log2(size_t v)
+	{	return v > 1 ? 1 + log2(v / 2) : 0;	}
+
+	static constexpr unsigned page_bits = log2(PageSize);
+	static constexpr Addr page_mask = PageSize - 1;
+	// page number is split in two directory levels
+	static constexpr unsigned l2_bits = (32 - page_bits) / 2;
+	static constexpr unsigned l1_bits = 32 - page_bits - l2_bits;
+	static constexpr Addr l2_mask = (1u << l2_bits) - 1;
+
+	static uint64_t bit(size_t ofs)
+	{	return 1ull << (ofs % 64);	}
+
+	static unsigned ctz(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward64(&idx, v);
+		return idx;
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+	static unsigned popcount(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		return unsigned(__popcnt64(v));
+#else
+		return __builtin_popcountll(v);
+#endif
+	}
+	// bits [from, to) of one word, 0 <= from < to <= 64
+	static uint64_t bits(size_t from, size_t to)
+	{
+		const uint64_t hi = (to == 64) ? ~0ull : ((1ull << to) - 1);
+		return hi & ~((1ull << from) - 1);
+	}
+
+	struct Page
+	{
+		uint8_t data[PageSize];
+		uint64_t used[PageSize / 64];
+		uint32_t count;
+
+		bool test(size_t ofs) const
+		{	return used[ofs / 64] & bit(ofs);	}
+
+		// Mark bytes [ofs, ofs+len) as used, return number of newly used bytes.
+		size_t mark(size_t ofs, size_t len)
+		{
+			size_t added = 0;
+			for (size_t pos = ofs, end = ofs + len; pos < end; )
+			{
+				const size_t w = pos / 64;
+				const size_t to = std::min<size_t>(end - w * 64, 64);
+				const uint64_t m = bits(pos % 64, to);
+				added += popcount(m & ~used[w]);
+				used[w] |= m;
+				pos = w * 64 + to;
+			}
+			return added;
+		}
+
+		// First used (find_set) or unused (find_clear) offset in [from, to), or 'to'.
+		size_t find_set(size_t from, size_t to) const
+		{	return scan(from, to, 0);	}
+		size_t find_clear(size_t from, size_t to) const
+		{	return scan(from, to, ~0ull);	}
+
+		size_t scan(size_t from, size_t to, uint64_t invert) const
+		{
+			for (size_t w = from / 64; w * 64 < to; w++)
+			{
+				uint64_t word = used[w] ^ invert;
+				if (w == from / 64)
+					word &= ~((1ull << (from % 64)) - 1);
+				if (word)
+					return std::min(w * 64 + ctz(word), to);
+			}
+			return to;
+		}
+
+		// Call f(addr, data, len) for runs of used bytes inside [from, to)
+		template <typename F>
+		void for_each_run(Addr base, size_t from, size_t to, F & f) const
+		{
+			for (size_t pos = from; pos < to; )
+			{
+				const size_t begin = find_set(pos, to);
+				if (begin == to)
+					break;
+				pos = find_clear(begin, to);
+				f(Addr(base + begin), data + begin, pos - begin);
+			}
+		}
+	};
+
+	using Alloc = AccountAllocator<uint8_t>;
+	using Table = std::vector<std::shared_ptr<Page>, AccountAllocator<std::shared_ptr<Page>>>;
+	Alloc alloc;
+	std::vector<std::shared_ptr<Table>, AccountAllocator<std::shared_ptr<Table>>> dir;
+	SegmentIndex index;
+	size_t count = 0;
+
+	const Page * get_page(Addr pgn) const
+	{
+		const Addr i = pgn >> l2_bits;
+		if (i >= dir.size() || ! dir[i])
+			return nullptr;
+		return (*dir[i])[pgn & l2_mask].get();
+	}
+
+	Page & make_page(Addr pgn)
+	{
+		if (dir.empty())
+			dir.resize(size_t(1) << l1_bits);
+		auto & table = dir[pgn >> l2_bits];
+		if (! table)
+			table = std::allocate_shared<Table>(alloc, size_t(1) << l2_bits, alloc);
+		auto & page = unshare(table, alloc)[pgn & l2_mask];
+		if (! page)
+			page = std::allocate_shared<Page>(alloc);
+		return unshare(page, alloc);
+	}
+
+	// Call f(base_addr, page) for every allocated page in ascending order,
+	// until f returns false.
+	template <typename F>
+	void for_each_page(F f) const
+	{
+		for (size_t i = 0; i < dir.size(); i++)
+		{
+			if (! dir[i]) continue;
+			const Table & table = *dir[i];
+			for (size_t j = 0; j < table.size(); j++)
+				if (table[j] && ! f(Addr((i << l2_bits | j) << page_bits), *table[j]))
+					return;
+		}
+	}
+};
@@ -0,0 +1,157 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include "../intelhex.h"
+#include "../intelhex_cache.h"
+#include "../intelhex_exception.h"
+#include "catch.hpp"
+#include "TestData.h"
+
+using namespace std;
+
+
+// Cache directory with a HEX file, removed at end of scope
+struct CacheDir
+{
+	const TempFile dir;
+	const TempFile hex;
+	const filesystem::path path = dir.name;
+	const string hexFile = hex.name;
+
+	size_t entries() const
+	{
+		size_t n = 0;
+		for (auto & e : filesystem::directory_iterator(path))
+			n += e.path().extension() == ".ihsnap";
+		return n;
+	}
+	filesystem::path entry() const
+	{
+		for (auto & e : filesystem::directory_iterator(path))
+			return e.path();
+		return {};
+	}
+};
+
+static IntelHex make_image(uint8_t fill, size_t size = 0x1000)
+{
+	IntelHex ih;
+	ih.frombytes(IntelHex::BinArray(size, fill), 0x08000000);
+	ih.start_addr = IntelHex::StartAddrExtended{ 0x08000101 };
+	return ih;
+}
+
+
+TEST_CASE("test_cache_hit_miss")
+{
+	CacheDir dir;
+	HexCache cache(dir.path.string());
+	make_image(0x11).write_hex_file(dir.hexFile);
+
+	IntelHex first = cache.load(dir.hexFile);
+	REQUIRE(cache.stats().misses == 1);
+	REQUIRE(cache.stats().hits == 0);
+	REQUIRE(dir.entries() == 1);
+
+	IntelHex second = cache.load(dir.hexFile);
+	REQUIRE(cache.stats().misses == 1);
+	REQUIRE(cache.stats().hits == 1);
+	REQUIRE(second.size() == 0x1000);
+	REQUIRE(second[0x08000FFF] == 0x11);
+	REQUIRE(second.start_addr == first.start_addr);
+
+	SECTION("changed file") {
+		make_image(0x22).write_hex_file(dir.hexFile);
+		IntelHex ih = cache.load(dir.hexFile);
+		REQUIRE(ih[0x08000000] == 0x22);
+		REQUIRE(cache.stats().misses == 2);
+		REQUIRE(dir.entries() == 2);
+
+		// other instance on the same directory
+		HexCache other(dir.path.string());
+		ih = other.load(dir.hexFile);
+		REQUIRE(ih[0x08000000] == 0x22);
+		REQUIRE(other.stats().hits == 1);
+	}
+
+	SECTION("broken entry is rewritten") {
+		ofstream(dir.entry(), ios::binary) << "garbage";
+		IntelHex ih = cache.load(dir.hexFile);
+		REQUIRE(ih[0x08000000] == 0x11);
+		REQUIRE(cache.stats().errors == 1);
+		REQUIRE(cache.stats().misses == 2);
+		ih = cache.load(dir.hexFile);
+		REQUIRE(cache.stats().hits == 2);
+	}
+
+	SECTION("clear") {
+		cache.clear();
+		REQUIRE(dir.entries() == 0);
+		cache.load(dir.hexFile);
+		REQUIRE(cache.stats().misses == 2);
+	}
+}
+
+TEST_CASE("test_cache_errors")
+{
+	CacheDir dir;
+	HexCache cache(dir.path.string());
+
+	ofstream(dir.hexFile) << ":0100000001FE\n:0100000002FD\n:00000001FF\n";
+	REQUIRE_THROWS_AS(cache.load(dir.hexFile), AddressOverlapError);
+	REQUIRE(dir.entries() == 0);
+
+	REQUIRE_THROWS_AS(cache.load(dir.hexFile + ".missing"), HexFileError);
+	REQUIRE(cache.stats().misses == 1);
+}
+
+TEST_CASE("test_cache_bad_directory")
+{
+	// cache directory can't be created inside a file
+	const TempFile file("not a directory");
+	const TempFile hex;
+	HexCache cache(file.name + "/cache");
+	make_image(0x11).write_hex_file(hex.name);
+
+	for (int i = 0; i < 2; i++)
+	{
+		IntelHex ih = cache.load(hex.name);
+		REQUIRE(ih[0x08000000] == 0x11);
+	}
+	REQUIRE(cache.stats().misses == 2);
+	REQUIRE(cache.stats().errors == 2);
+}
+
+TEST_CASE("test_cache_eviction")
+{
+	CacheDir dir;
+	// snapshot of 0x1000 bytes takes 0x1080 bytes
+	HexCache cache(dir.path.string(), 0x2200);
+	const auto hour_ago = filesystem::file_time_type::clock::now() - chrono::hours(1);
+
+	make_image(0x01).write_hex_file(dir.hexFile);
+	cache.load(dir.hexFile);
+	const auto first = dir.entry();
+	make_image(0x02).write_hex_file(dir.hexFile);
+	cache.load(dir.hexFile);
+	REQUIRE(dir.entries() == 2);
+	REQUIRE(cache.stats().evictions == 0);
+	for (auto & e : filesystem::directory_iterator(dir.path))
+		filesystem::last_write_time(e.path(), hour_ago);
+
+	// hit makes the first entry recently used
+	make_image(0x01).write_hex_file(dir.hexFile);
+	cache.load(dir.hexFile);
+	REQUIRE(cache.stats().hits == 1);
+
+	make_image(0x03).write_hex_file(dir.hexFile);
+	cache.load(dir.hexFile);
+	REQUIRE(cache.stats().evictions == 1);
+	REQUIRE(dir.entries() == 2);
+	REQUIRE(filesystem::exists(first));
+
+	// entry larger than the limit is not kept
+	make_image(0x04, 0x3000).write_hex_file(dir.hexFile);
+	cache.load(dir.hexFile);
+	REQUIRE(dir.entries() == 0);
+}
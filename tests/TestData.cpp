@@ -1,4 +1,8 @@
 #include "TestData.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
 
 
 const std::string hex8 =
@@ -228,3 +232,33 @@ const uint8_t bin8[1454] = {
 	246, 48, 153, 253, 194, 153, 245, 153, 34, 120, 127,
 	228, 246, 216, 253, 117, 129, 122, 2, 5, 58 };
 
+
+static std::string unique_temp_name()
+{
+	// names don't clash between test runs started at the same time
+	static thread_local std::mt19937_64 rnd(std::random_device{}());
+	return (std::filesystem::temp_directory_path() / ("intelhex_test_" + std::to_string(rnd()))).string();
+}
+
+TempFile::TempFile()
+	: name(unique_temp_name())
+{}
+
+TempFile::TempFile(const std::string &content)
+	: name(unique_temp_name())
+{	write(content);	}
+
+TempFile::~TempFile()
+{
+	std::error_code ec;
+	std::filesystem::remove_all(name, ec);
+}
+
+std::string TempFile::read() const
+{
+	std::ifstream f(name, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+void TempFile::write(const std::string &content) const
+{	std::ofstream(name, std::ios::binary) << content;	}
@@ -1,6 +1,26 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 extern const std::string hex8;
 extern const uint8_t bin8[1454];
+
+
+// Temporary file (or directory) with a unique name, removed at end of scope
+struct TempFile
+{
+	const std::string name;
+
+	// only the name, nothing is created
+	TempFile();
+	// file with the content
+	explicit TempFile(const std::string & content);
+	~TempFile();
+
+	TempFile(const TempFile &) = delete;
+	TempFile & operator=(const TempFile &) = delete;
+
+	std::string read() const;
+	void write(const std::string & content) const;
+};
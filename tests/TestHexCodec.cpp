@@ -0,0 +1,104 @@
+#include <random>
+#include <string>
+#include <vector>
+#include "../intelhex_codec.h"
+#include "catch.hpp"
+
+using namespace std;
+
+using Kernel = HexCodec::Kernel;
+
+
+static string to_hex(const vector<uint8_t> & bin, bool lower)
+{
+	const char * digits = lower ? "0123456789abcdef" : "0123456789ABCDEF";
+	string str;
+	for (auto b : bin)
+	{
+		str += digits[b >> 4];
+		str += digits[b & 0x0F];
+	}
+	return str;
+}
+
+
+TEST_CASE("test_hex_decode_kernels")
+{
+	mt19937 rnd(1);
+	for (auto kernel : { Kernel::scalar, Kernel::sse2, Kernel::avx2 })
+	{
+		if (! HexCodec::supported(kernel))
+			continue;
+		INFO("kernel " << HexCodec::name(kernel));
+
+		for (size_t len : { 0, 1, 5, 15, 16, 17, 21, 32, 33, 37, 64, 100, 260 })
+		{
+			vector<uint8_t> bin(len);
+			uint8_t expected_sum = 0;
+			for (auto & b : bin)
+			{
+				b = uint8_t(rnd());
+				expected_sum += b;
+			}
+
+			for (bool lower : { false, true })
+			{
+				const string hex = to_hex(bin, lower);
+				vector<uint8_t> out(len + 1, 0xA5);
+				uint8_t sum = 0;
+				REQUIRE(HexCodec::decode(kernel, hex.data(), hex.size(), out.data(), sum));
+				REQUIRE(vector<uint8_t>(out.begin(), out.begin() + len) == bin);
+				REQUIRE(out[len] == 0xA5);		// no overrun
+				REQUIRE(sum == expected_sum);
+			}
+
+			// every non-hex character at every position is rejected
+			string hex = to_hex(bin, false);
+			vector<uint8_t> out(len);
+			uint8_t sum;
+			for (size_t pos = 0; pos < hex.size(); pos++)
+			{
+				for (char bad : { 'G', 'g', '/', ':', '@', '`', ' ', '\0', '\x80', '\xC6' })
+				{
+					const char save = hex[pos];
+					hex[pos] = bad;
+					REQUIRE_FALSE(HexCodec::decode(kernel, hex.data(), hex.size(), out.data(), sum));
+					hex[pos] = save;
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("test_hex_is_hex")
+{
+	REQUIRE(HexCodec::is_hex("0123456789abcdefABCDEF", 22));
+	REQUIRE_FALSE(HexCodec::is_hex("00x0", 4));
+}
+
+TEST_CASE("test_hex_encode_kernels")
+{
+	mt19937 rnd(2);
+	for (auto kernel : { Kernel::scalar, Kernel::sse2, Kernel::avx2 })
+	{
+		if (! HexCodec::supported(kernel))
+			continue;
+		INFO("kernel " << HexCodec::name(kernel));
+
+		for (size_t len : { 0, 1, 4, 15, 16, 17, 31, 32, 33, 48, 100, 255 })
+		{
+			vector<uint8_t> bin(len);
+			uint8_t expected_sum = 0;
+			for (auto & b : bin)
+			{
+				b = uint8_t(rnd());
+				expected_sum += b;
+			}
+
+			string out(2 * len + 1, '#');
+			REQUIRE(HexCodec::encode(kernel, bin.data(), len, &out[0]) == expected_sum);
+			REQUIRE(out.substr(0, 2 * len) == to_hex(bin, false));
+			REQUIRE(out.back() == '#');		// no overrun
+		}
+	}
+}
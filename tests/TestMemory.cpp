@@ -0,0 +1,225 @@
+#include <memory>
+#include <memory_resource>
+#include <sstream>
+#include "../intelhex.h"
+#include "../intelhex_exception.h"
+#include "catch.hpp"
+#include "TestData.h"
+
+using namespace std;
+
+
+// HEX text of 'size' bytes at addr
+static string make_hex(size_t size, IntelHex::Addr addr = 0)
+{
+	IntelHex ih;
+	ih.frombytes(IntelHex::BinArray(size, 0x5A), addr);
+	ostringstream ss;
+	ih.write_hex_file(ss);
+	return ss.str();
+}
+
+// Resource which counts memory taken from the heap
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	size_t current = 0;
+	size_t allocations = 0;
+
+private:
+	void * do_allocate(size_t size, size_t align) override
+	{
+		current += size;
+		allocations++;
+		return std::pmr::new_delete_resource()->allocate(size, align);
+	}
+	void do_deallocate(void * p, size_t size, size_t align) override
+	{
+		current -= size;
+		std::pmr::new_delete_resource()->deallocate(p, size, align);
+	}
+	bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override
+	{	return this == &other;	}
+};
+
+
+TEST_CASE("test_memory_stats")
+{
+	IntelHex ih;
+	REQUIRE(ih.memory_stats().payload == 0);
+	REQUIRE(ih.memory_stats().blocks == 0);
+
+	istringstream f(make_hex(0x10000, 0x8000));
+	ih.loadhex(f);
+	auto stats = ih.memory_stats();
+	REQUIRE(stats.payload == 0x10000);
+	REQUIRE(stats.allocated >= stats.payload);
+	REQUIRE(stats.overhead == stats.allocated - stats.payload);
+	REQUIRE(stats.blocks >= 16);
+	REQUIRE(stats.segments == 1);
+	REQUIRE(stats.peak >= stats.allocated);
+
+	// copy shares blocks, only its containers are allocated;
+	// modified block is cloned
+	IntelHex copy(ih);
+	const size_t shared = copy.memory_stats().allocated;
+	REQUIRE(shared - stats.allocated < stats.payload / 2);
+	copy.add(0x9000, 0x11);
+	const size_t cloned = copy.memory_stats().allocated - shared;
+	REQUIRE(cloned >= 0x1000);
+	REQUIRE(cloned < stats.payload / 2);
+	REQUIRE(ih[0x9000] == 0x5A);
+
+	ih.del(0x8000);
+	REQUIRE(ih.memory_stats().segments == 1);
+	ih.del(0x9001);
+	REQUIRE(ih.memory_stats().segments == 2);
+}
+
+TEST_CASE("test_memory_budget")
+{
+	auto budget = make_shared<MemoryBudget>(0x20000);
+	const string big = make_hex(0x40000);
+	const string small = make_hex(0x1000);
+
+	SECTION("image within budget") {
+		IntelHex ih;
+		ih.set_memory_hook(budget);
+		istringstream f(small);
+		REQUIRE(ih.try_loadhex(f).ok());
+		REQUIRE(ih.size() == 0x1000);
+		REQUIRE(budget->used() == ih.memory_stats().allocated);
+
+		// copies are counted by the same budget
+		IntelHex copy(ih);
+		copy.add(0, 0);
+		REQUIRE(budget->used() == copy.memory_stats().allocated);
+		REQUIRE(budget->used() > ih.memory_stats().payload);
+	}
+
+	SECTION("image above budget is rejected") {
+		IntelHex ih;
+		ih.set_memory_hook(budget);
+		istringstream f(big);
+		const HexResult res = ih.try_loadhex(f);
+		REQUIRE(res.error == HexError::memory_limit);
+		REQUIRE(res.line > 0x10000 / 16);		// storage overhead is counted too
+		REQUIRE(res.line <= 0x20000 / 16 + 2);
+		REQUIRE(ih.size() == 0);
+		REQUIRE(budget->used() < 0x1000);
+
+		istringstream f2(big);
+		REQUIRE_THROWS_AS(ih.loadhex(f2), MemoryLimitError);
+
+		// lenient loading stops at the same place
+		istringstream f3(big);
+		auto diags = ih.loadhex_lenient(f3, IntelHex::LenientPolicy::apply);
+		REQUIRE(diags.size() == 1);
+		REQUIRE(diags[0].error == HexError::memory_limit);
+		REQUIRE(ih.size() == 0);
+	}
+
+	SECTION("scratch buffers of threaded loading are counted") {
+		// decoded records of all threads are kept until the image is filled
+		TempFile file(big);
+		IntelHex loaded;
+		loaded.loadhex_mmap(file.name, 1);
+		// enough for the image, not for the image and decoded records
+		auto tight = make_shared<MemoryBudget>(loaded.memory_stats().allocated + 0x1000);
+		REQUIRE(tight->limit() < big.size());
+
+		IntelHex ih;
+		ih.set_memory_hook(tight);
+		REQUIRE(ih.try_loadhex_mmap(file.name, 1).ok());
+		ih = IntelHex();
+		ih.set_memory_hook(tight);
+		const HexResult res = ih.try_loadhex_mmap(file.name, 4);
+		REQUIRE(res.error == HexError::memory_limit);
+		REQUIRE(ih.size() == 0);
+		REQUIRE(tight->used() == 0);
+		REQUIRE_THROWS_AS(ih.loadhex_mmap(file.name, 4), MemoryLimitError);
+	}
+
+	SECTION("hook of loaded image") {
+		IntelHex ih;
+		ih.frombytes(IntelHex::BinArray(0x40000, 0x11), 0);
+		REQUIRE_THROWS_AS(ih.set_memory_hook(budget), MemoryLimitError);
+		REQUIRE(ih.size() == 0x40000);
+		REQUIRE(budget->used() == 0);
+
+		ih.frombytes(IntelHex::BinArray(0x1000, 0x11), 0x80000);
+		for (IntelHex::Addr a = 0; a < 0x40000; a++)
+			ih.del(a);
+		ih.set_memory_hook(budget);
+		REQUIRE(ih.size() == 0x1000);
+		REQUIRE(ih[0x80000] == 0x11);
+		REQUIRE(budget->used() == ih.memory_stats().allocated);
+	}
+
+	// memory is returned when images are destroyed
+	REQUIRE(budget->used() == 0);
+}
+
+TEST_CASE("test_memory_resource")
+{
+	const string hex = make_hex(0x20000, 0x10000);
+	CountingResource counter;
+
+	SECTION("storage and scratch buffers") {
+		{
+			IntelHex ih(&counter);
+			REQUIRE(ih.memory_resource() == &counter);
+			istringstream f(hex);
+			ih.loadhex(f);
+			REQUIRE(counter.current == ih.memory_stats().allocated);
+
+			// copies use the same resource
+			IntelHex copy(ih);
+			copy.add(0, 0);
+			REQUIRE(copy.memory_resource() == &counter);
+			REQUIRE(counter.current == copy.memory_stats().allocated);
+
+			// data is moved out of the resource
+			copy.set_memory_resource(std::pmr::new_delete_resource());
+			REQUIRE(copy.size() == 0x20001);
+			REQUIRE(copy[0x10000] == 0x5A);
+			REQUIRE(counter.current == ih.memory_stats().allocated);
+
+			// scratch buffer of loadbin
+			const size_t before = counter.allocations;
+			istringstream bin("1234");
+			ih.loadbin(bin, 0x100);
+			REQUIRE(counter.allocations > before + 1);
+		}
+		REQUIRE(counter.current == 0);
+	}
+
+	SECTION("arena") {
+		std::pmr::monotonic_buffer_resource arena(&counter);
+		{
+			IntelHex ih(&arena);
+			ih.set_memory_hook(make_shared<MemoryBudget>(0x100000));
+			REQUIRE(ih.memory_resource() == &arena);
+			istringstream f(hex);
+			REQUIRE(ih.try_loadhex(f).ok());
+			REQUIRE(ih.size() == 0x20000);
+		}
+		// memory is returned by the arena at once
+		REQUIRE(counter.current > 0x20000);
+		arena.release();
+		REQUIRE(counter.current == 0);
+	}
+
+	SECTION("threads") {
+		// big file is decoded by several threads
+		const string big = make_hex(0x200000);
+		TempFile file(big);
+		{
+			std::pmr::monotonic_buffer_resource arena(&counter);
+			IntelHex ih(&arena);
+			ih.loadhex_mmap(file.name, 4);
+			REQUIRE(ih.size() == 0x200000);
+		}
+		REQUIRE(counter.current == 0);
+	}
+}
@@ -1,5 +1,7 @@
+#include <random>
 #include <sstream>
 #include "../intelhex.h"
+#include "../intelhex_exception.h"
 #include "catch.hpp"
 
 using namespace std;
@@ -55,6 +57,128 @@ TEST_CASE("test_merge_overlap")
 	}
 }
 
+TEST_CASE("test_merge_ranges")
+{
+	// bootloader and application overlapped in a few places
+	IntelHex boot, app;
+	boot.frombytes(IntelHex::BinArray(0x1000, 0xB0), 0);
+	boot.frombytes(IntelHex::BinArray(0x10, 0xB1), 0x5000);
+	boot.frombytes(IntelHex::BinArray(0x10, 0xB2), 0x7FF8);
+	app.frombytes(IntelHex::BinArray(0x8000, 0xA0), 0xFF0);
+
+	SECTION("overlap error") {
+		IntelHex ih(boot);
+		try {
+			ih.merge(app, IntelHex::Overlap::error);
+			FAIL();
+		}
+		catch (const AddressOverlapError & e) {
+			REQUIRE(string(e.what()) == "Data overlapped at address 0xff0");
+		}
+		// nothing merged
+		REQUIRE(ih.size() == boot.size());
+		REQUIRE(ih.tobinarray() == boot.tobinarray());
+	}
+
+	SECTION("overlap ignore") {
+		IntelHex ih(boot);
+		ih.merge(app, IntelHex::Overlap::ignore);
+		REQUIRE(ih.size() == 0x8FF0);
+		REQUIRE(ih.segments().size() == 1);
+		REQUIRE(ih[0xFFF] == 0xB0);
+		REQUIRE(ih[0x1000] == 0xA0);
+		REQUIRE(ih[0x4FFF] == 0xA0);
+		REQUIRE(ih[0x5000] == 0xB1);
+		REQUIRE(ih[0x500F] == 0xB1);
+		REQUIRE(ih[0x5010] == 0xA0);
+		REQUIRE(ih[0x7FF7] == 0xA0);
+		REQUIRE(ih[0x7FF8] == 0xB2);
+		REQUIRE(ih[0x8007] == 0xB2);
+		REQUIRE(ih[0x8008] == 0xA0);
+		REQUIRE(ih[0x8FEF] == 0xA0);
+	}
+
+	SECTION("overlap replace") {
+		IntelHex ih(boot);
+		ih.merge(app, IntelHex::Overlap::replace);
+		REQUIRE(ih.size() == 0x8FF0);
+		REQUIRE(ih[0xFEF] == 0xB0);
+		REQUIRE(ih[0xFF0] == 0xA0);
+		REQUIRE(ih[0x5000] == 0xA0);
+		REQUIRE(ih[0x8007] == 0xA0);
+	}
+}
+
+TEST_CASE("test_merge_all")
+{
+	IntelHex a, b, c;
+	a.frombytes(IntelHex::BinArray(0x100, 0xAA), 0x1000);
+	b.frombytes(IntelHex::BinArray(0x100, 0xBB), 0x1080);
+	c.frombytes(IntelHex::BinArray(0x10, 0xCC), 0x10F8);
+	c.frombytes(IntelHex::BinArray(0x10, 0xCC), 0xFFFFFFF0);
+	c.start_addr = IntelHex::StartAddrExtended{ 0x1000 };
+
+	SECTION("conflicts with provenance") {
+		vector<IntelHex::MergeConflict> conflicts;
+		try {
+			IntelHex::merge_all({ &a, &b, &c }, IntelHex::Overlap::error, &conflicts);
+			FAIL();
+		}
+		catch (const AddressOverlapError & e) {
+			REQUIRE(string(e.what()) == "Data overlapped at address 0x1080 (images 0 and 1)");
+		}
+		REQUIRE(conflicts.size() == 3);
+		REQUIRE(conflicts[0].begin == 0x1080);
+		REQUIRE(conflicts[0].end == 0x1100);
+		REQUIRE(conflicts[0].first == 0);
+		REQUIRE(conflicts[0].second == 1);
+		REQUIRE(conflicts[1].begin == 0x10F8);
+		REQUIRE(conflicts[1].end == 0x1100);
+		REQUIRE(conflicts[1].first == 0);
+		REQUIRE(conflicts[1].second == 2);
+		REQUIRE(conflicts[2].begin == 0x10F8);
+		REQUIRE(conflicts[2].end == 0x1108);
+		REQUIRE(conflicts[2].first == 1);
+		REQUIRE(conflicts[2].second == 2);
+	}
+
+	SECTION("no conflicts") {
+		IntelHex d;
+		d.frombytes(IntelHex::BinArray(0x10, 0xDD), 0xFFFFFFF0);
+		d.start_addr = c.start_addr;
+		vector<IntelHex::MergeConflict> conflicts{ { 0, 0, 0, 0 } };
+		IntelHex ih = IntelHex::merge_all({ &a, &d }, IntelHex::Overlap::error, &conflicts);
+		REQUIRE(conflicts.empty());
+		REQUIRE(ih.size() == 0x110);
+		REQUIRE(ih.maxaddr() == 0xFFFFFFFF);
+		REQUIRE(ih[0xFFFFFFFF] == 0xDD);
+		REQUIRE(ih.start_addr == d.start_addr);
+		REQUIRE(IntelHex::merge_all({}).size() == 0);
+	}
+
+	SECTION("same as sequential merge") {
+		mt19937 rnd(7);
+		vector<IntelHex> images(6);
+		for (size_t i = 0; i < images.size(); i++)
+			for (int n = 0; n < 20; n++)
+				images[i].frombytes(IntelHex::BinArray(rnd() % 300 + 1, uint8_t(i)), rnd() % 0x3000);
+		vector<const IntelHex *> ptrs;
+		for (auto & ih : images)
+			ptrs.push_back(&ih);
+
+		for (auto overlap : { IntelHex::Overlap::ignore, IntelHex::Overlap::replace })
+		{
+			IntelHex expected;
+			for (auto & ih : images)
+				expected.merge(ih, overlap);
+			IntelHex ih = IntelHex::merge_all(ptrs, overlap);
+			REQUIRE(ih.size() == expected.size());
+			REQUIRE(ih.segments().size() == expected.segments().size());
+			REQUIRE(ih.tobinarray() == expected.tobinarray());
+		}
+	}
+}
+
 TEST_CASE("test_merge_start_addr")
 {
 	IntelHex::StartAddrExtended start_addr{ 0x12345678 };
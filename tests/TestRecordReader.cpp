@@ -0,0 +1,87 @@
+#include <sstream>
+#include <vector>
+#include "../intelhex_record.h"
+#include "../intelhex_exception.h"
+#include "TestData.h"
+#include "catch.hpp"
+
+using namespace std;
+
+
+TEST_CASE("test_record_reader")
+{
+	const string text =
+		":0200000480007A\n"
+		":0400100001020304E2\n"
+		"\n"
+		":020000021000EC\n"
+		":02FFF000AABBAA\n"
+		":04000005000000CD2A\n"
+		":00000001FF\n";
+
+	struct Seen {
+		uint8_t type;
+		uint32_t address;
+		vector<uint8_t> data;
+		uint32_t line;
+	};
+	vector<Seen> seen;
+	auto collect = [&seen](const HexRecord & rec)
+	{	seen.push_back({ rec.type, rec.address, { rec.data, rec.data + rec.length }, rec.line });	};
+
+	SECTION("stream") {
+		istringstream stream(text);
+		HexRecordReader reader;
+		reader.read(stream, collect);
+		REQUIRE(reader.line() == 7);
+	}
+	SECTION("text") {
+		HexRecordReader reader;
+		reader.read(string_view(text), collect);
+	}
+
+	REQUIRE(seen.size() == 6);		// empty line is skipped
+	REQUIRE(seen[0].type == 4);
+	REQUIRE(seen[1].type == 0);
+	REQUIRE(seen[1].address == 0x80000010);
+	REQUIRE(seen[1].data == vector<uint8_t>{ 1, 2, 3, 4 });
+	REQUIRE(seen[1].line == 2);
+	REQUIRE(seen[3].address == 0x10000 + 0xFFF0);	// 02 record replaces 04 offset
+	REQUIRE(seen[3].line == 5);
+	REQUIRE(seen[4].type == 5);
+	REQUIRE(seen[4].data == vector<uint8_t>{ 0, 0, 0, 0xCD });
+	REQUIRE(seen[5].type == 1);
+}
+
+TEST_CASE("test_record_reader_errors")
+{
+	HexRecordReader reader;
+	REQUIRE(reader.next(":0100000001FE") != nullptr);
+	REQUIRE(reader.next("") == nullptr);
+	REQUIRE_THROWS_AS(reader.next(":0100000001FF"), RecordChecksumError);
+	REQUIRE(reader.line() == 3);
+
+	reader.reset();
+	REQUIRE(reader.line() == 0);
+}
+
+TEST_CASE("test_record_reader_sum")
+{
+	// inspect data without building an image
+	istringstream stream(hex8);
+	HexRecordReader reader;
+	size_t total = 0;
+	uint32_t sum = 0, expected = 0;
+	reader.read(stream, [&](const HexRecord & rec)
+	{
+		if (rec.type != 0)
+			return;
+		total += rec.length;
+		for (size_t i = 0; i < rec.length; i++)
+			sum += rec.data[i];
+	});
+	for (auto b : bin8)
+		expected += b;
+	REQUIRE(total == sizeof(bin8));
+	REQUIRE(sum == expected);
+}
@@ -0,0 +1,127 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "../intelhex.h"
+#include "../intelhex_record.h"
+#include "catch.hpp"
+#include "TestData.h"
+
+using namespace std;
+
+using Addressing = HexRecordWriter::Addressing;
+
+
+TEST_CASE("test_record_writer_join_chunks")
+{
+	ostringstream sio;
+	HexRecordWriter writer(sio, 4);
+	const uint8_t data[] = { 1, 2, 3, 4, 5, 6, 7 };
+	writer.data(0x10, data, 3);
+	writer.data(0x13, data + 3, 3);		// continues the record
+	writer.data(0x20, data + 6, 1);		// hole: new record
+	writer.finish();
+
+	REQUIRE(sio.str() ==
+		":0400100001020304E2\n"
+		":020014000506DF\n"
+		":0100200007D8\n"
+		":00000001FF\n");
+}
+
+TEST_CASE("test_record_writer_finish_flushes")
+{
+	TempFile file;
+	ofstream out(file.name, ios::binary);
+	HexRecordWriter writer(out, 16);
+	const uint8_t data[] = { 1, 2, 3 };
+	writer.data(0x10, data, sizeof(data));
+	writer.finish();
+
+	// output is complete while the stream is still open
+	REQUIRE(file.read() ==
+		":03001000010203E7\n"
+		":00000001FF\n");
+}
+
+TEST_CASE("test_record_writer_address_records")
+{
+	ostringstream sio;
+	const uint8_t data[] = { 1, 2, 3, 4 };
+
+	SECTION("split at 64K boundary") {
+		HexRecordWriter writer(sio);
+		writer.data(0xFFFE, data, 4);
+		writer.finish();
+		REQUIRE(sio.str() ==
+			":02FFFE000102FE\n"
+			":020000040001F9\n"
+			":020000000304F7\n"
+			":00000001FF\n");
+	}
+
+	SECTION("forced address record") {
+		HexRecordWriter writer(sio);
+		writer.force_address_record();
+		writer.data(0x10, data, 1);
+		writer.finish();
+		REQUIRE(sio.str() ==
+			":020000040000FA\n"
+			":0100100001EE\n"
+			":00000001FF\n");
+	}
+
+	SECTION("segmented") {
+		HexRecordWriter writer(sio, 16, Addressing::segmented);
+		writer.data(0x12345, data, 2);
+		writer.finish();
+		REQUIRE(sio.str() ==
+			":020000021000EC\n"
+			":02234500010293\n"
+			":00000001FF\n");
+	}
+
+	SECTION("start address") {
+		HexRecordWriter writer(sio);
+		writer.start_segment(0x1234, 0x5678);
+		writer.start_linear(0xDEADBEEF);
+		writer.finish();
+		REQUIRE(sio.str() ==
+			":0400000312345678E5\n"
+			":04000005DEADBEEFBF\n"
+			":00000001FF\n");
+	}
+}
+
+TEST_CASE("test_record_writer_errors")
+{
+	ostringstream sio;
+	const uint8_t data[] = { 1, 2, 3, 4 };
+	REQUIRE_THROWS_AS(HexRecordWriter(sio, 0), length_error);
+	REQUIRE_THROWS_AS(HexRecordWriter(sio, 256), length_error);
+
+	HexRecordWriter writer(sio);
+	writer.data(0x100, data, 4);
+	REQUIRE_THROWS_AS(writer.data(0x103, data, 1), out_of_range);
+	REQUIRE_THROWS_AS(writer.data(0xFFFFFFFE, data, 4), out_of_range);
+
+	HexRecordWriter segmented(sio, 16, Addressing::segmented);
+	REQUIRE_THROWS_AS(segmented.data(0xFFFFE, data, 4), out_of_range);
+}
+
+TEST_CASE("test_record_writer_big_image")
+{
+	// generated data goes straight to the writer, then read back
+	IntelHex::BinArray data(0x30000);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = uint8_t(i * 7);
+
+	stringstream sio;
+	HexRecordWriter writer(sio, 32);
+	for (size_t pos = 0; pos < data.size(); pos += 1000)
+		writer.data(0x1FFF0 + pos, data.data() + pos, min<size_t>(1000, data.size() - pos));
+	writer.finish();
+
+	IntelHex ih(sio);
+	REQUIRE(ih.minaddr() == 0x1FFF0);
+	REQUIRE(ih.tobinarray() == data);
+}
@@ -0,0 +1,125 @@
+#include <sstream>
+#include <system_error>
+#include "../intelhex.h"
+#include "../intelhex_exception.h"
+#include "../intelhex_snapshot.h"
+#include "catch.hpp"
+#include "TestData.h"
+
+using namespace std;
+
+
+static bool same_image(const IntelHex & a, const IntelHex & b)
+{
+	const auto sa = a.segments(), sb = b.segments();
+	if (sa.size() != sb.size() || a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < sa.size(); i++)
+		if (sa[i].begin != sb[i].begin || sa[i].end != sb[i].end)
+			return false;
+	for (auto & seg : sa)
+		for (IntelHex::Addr addr = seg.begin; addr != seg.end; addr++)
+			if (a[addr] != b[addr])
+				return false;
+	return true;
+}
+
+
+TEST_CASE("test_snapshot_roundtrip")
+{
+	IntelHex ih;
+	for (int i = 0; i < 300; i++)
+		ih.add(0x1000 + i, uint8_t(i));
+	ih.frombytes(IntelHex::BinArray(0x20000, 0x77), 0x08000000);
+	ih.frombytes(IntelHex::BinArray(0x10, 0x99), 0xFFFFFFF0);		// up to the end of address space
+	ih.padding = 0x00;
+	TempFile file;
+
+	SECTION("linear start address") {
+		ih.start_addr = IntelHex::StartAddrExtended{ 0x08000123 };
+		ih.save_snapshot(file.name);
+
+		IntelHex loaded{ { 0x10, 0x10 } };		// old content is replaced
+		loaded.load_snapshot(file.name);
+		REQUIRE(same_image(loaded, ih));
+		REQUIRE(loaded.start_addr == ih.start_addr);
+		REQUIRE(loaded.padding == 0x00);
+	}
+
+	SECTION("segmented start address") {
+		ih.start_addr = IntelHex::StartAddrSegmented{ 0x1234, 0x5678 };
+		ih.save_snapshot(file.name);
+		IntelHex loaded;
+		loaded.load_snapshot(file.name);
+		REQUIRE(loaded.start_addr == ih.start_addr);
+	}
+
+	SECTION("mapped view") {
+		ih.save_snapshot(file.name);
+		HexSnapshot snap(file.name);
+		REQUIRE(snap.size() == ih.size());
+		REQUIRE(! snap.start_addr().has_value());
+		REQUIRE(snap.segments().size() == 3);
+		REQUIRE(snap.segments()[1].begin == 0x08000000);
+		REQUIRE(snap.segments()[1].length == 0x20000);
+		REQUIRE(snap.segments()[1].data[0x1FFFF] == 0x77);
+		REQUIRE(snap.segments()[2].length == 0x10);
+	}
+
+	SECTION("empty image") {
+		IntelHex empty;
+		empty.save_snapshot(file.name);
+		ih.load_snapshot(file.name);
+		REQUIRE(ih.size() == 0);
+		REQUIRE(! ih.start_addr.has_value());
+		REQUIRE(ih.padding == 0xFF);
+	}
+}
+
+TEST_CASE("test_snapshot_errors")
+{
+	IntelHex ih;
+	ih.frombytes(IntelHex::BinArray(0x100, 0x11), 0x100);
+	ih.frombytes(IntelHex::BinArray(0x100, 0x22), 0x400);
+	TempFile file;
+	ih.save_snapshot(file.name);
+	const string good = file.read();
+	REQUIRE(good.size() == 128 + 0x200);		// header, table (aligned) and payload
+
+	auto require_error = [&](const string & content, const char * message)
+	{
+		file.write(content);
+		IntelHex loaded;
+		try {
+			loaded.load_snapshot(file.name);
+			FAIL(message);
+		}
+		catch (const SnapshotError & e) {
+			REQUIRE(string(e.what()) == string("Invalid snapshot file: ") + message);
+		}
+	};
+
+	require_error("IHEXSNAP", "not a snapshot file");
+	require_error(":020000040800F2\n" + good, "not a snapshot file");
+
+	string bad = good;
+	bad[8] = 2;
+	require_error(bad, "unsupported version");
+
+	require_error(good.substr(0, good.size() - 1), "file is truncated or has wrong size");
+	require_error(good + '\0', "file is truncated or has wrong size");
+
+	bad = good;
+	bad[64] ^= 1;			// address of the first segment
+	require_error(bad, "header checksum mismatch");
+
+	// payload is not checksummed
+	bad = good;
+	bad[128] = 0x33;
+	file.write(bad);
+	IntelHex loaded;
+	loaded.load_snapshot(file.name);
+	REQUIRE(loaded[0x100] == 0x33);
+
+	REQUIRE_THROWS_AS(loaded.load_snapshot(file.name + ".missing"), system_error);
+}
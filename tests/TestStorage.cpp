@@ -0,0 +1,233 @@
+#include "../intelhex_storage.h"
+#include "catch.hpp"
+
+using namespace std;
+
+using Addr = ExtentStorage::Addr;
+using Runs = vector<pair<Addr, size_t>>;
+
+template <typename Storage>
+static Runs runs(const Storage & st)
+{
+	Runs r;
+	st.for_each_run([&r](Addr addr, const uint8_t *, size_t len)
+	{	r.push_back({addr, len});	});
+	return r;
+}
+
+
+TEMPLATE_TEST_CASE("test_storage_set_find", "", ExtentStorage, PagedStorage<>)
+{
+	TestType st;
+	REQUIRE(st.empty());
+	REQUIRE(st.find(0) == nullptr);
+
+	st.set(10, 1);
+	st.set(12, 3);
+	REQUIRE(st.size() == 2);
+	REQUIRE(runs(st) == Runs{ {10, 1}, {12, 1} });
+
+	// fill the hole: extents are joined
+	st.set(11, 2);
+	REQUIRE(st.size() == 3);
+	REQUIRE(runs(st) == Runs{ {10, 3} });
+	REQUIRE(*st.find(10) == 1);
+	REQUIRE(*st.find(11) == 2);
+	REQUIRE(*st.find(12) == 3);
+	REQUIRE(st.find(13) == nullptr);
+
+	// overwrite keeps size
+	st.set(11, 5);
+	REQUIRE(st.size() == 3);
+	REQUIRE(*st.find(11) == 5);
+
+	REQUIRE(st.min_addr() == 10);
+	REQUIRE(st.max_addr() == 12);
+}
+
+TEMPLATE_TEST_CASE("test_storage_write", "", ExtentStorage, PagedStorage<>)
+{
+	TestType st;
+	vector<uint8_t> data(0x3000);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = uint8_t(i);
+
+	SECTION("split on block/page boundaries") {
+		st.write(0x800, data.data(), data.size());
+		REQUIRE(st.size() == data.size());
+		REQUIRE(runs(st) == Runs{ {0x800, 0x800}, {0x1000, 0x1000}, {0x2000, 0x1000}, {0x3000, 0x800} });
+		for (size_t i = 0; i < data.size(); i++)
+			REQUIRE(*st.find(0x800 + i) == data[i]);
+	}
+
+	SECTION("join and overwrite") {
+		st.write(0x10, data.data(), 4);
+		st.write(0x20, data.data(), 4);
+		st.write(0x0C, data.data() + 100, 0x16);	// covers both and the gap
+		REQUIRE(st.size() == 0x18);
+		REQUIRE(runs(st) == Runs{ {0x0C, 0x18} });
+		REQUIRE(*st.find(0x0C) == 100);
+		REQUIRE(*st.find(0x21) == 100 + 0x15);
+		REQUIRE(*st.find(0x23) == 3);
+	}
+
+	SECTION("wrap at 4G") {
+		st.write(0xFFFFFFFE, data.data(), 4);
+		REQUIRE(st.size() == 4);
+		REQUIRE(runs(st) == Runs{ {0, 2}, {0xFFFFFFFE, 2} });
+		REQUIRE(st.max_addr() == 0xFFFFFFFF);
+		REQUIRE(st.find_used(0xFFFFFFF0, 0x10) == 0xFFFFFFFE);
+		REQUIRE(st.find_used(0xFFFFFFF0, 0x20) == 0xFFFFFFFE);
+	}
+}
+
+TEMPLATE_TEST_CASE("test_storage_erase", "", ExtentStorage, PagedStorage<>)
+{
+	TestType st;
+	const uint8_t data[] = {1, 2, 3, 4, 5};
+	st.write(100, data, sizeof(data));
+
+	REQUIRE_FALSE(st.erase(99));
+	REQUIRE(st.erase(102));		// split
+	REQUIRE(runs(st) == Runs{ {100, 2}, {103, 2} });
+	REQUIRE(st.erase(100));		// first byte
+	REQUIRE(st.erase(104));		// last byte
+	REQUIRE(runs(st) == Runs{ {101, 1}, {103, 1} });
+	REQUIRE(*st.find(101) == 2);
+	REQUIRE(*st.find(103) == 4);
+	REQUIRE(st.size() == 2);
+	REQUIRE(st.erase(101));
+	REQUIRE(st.erase(103));
+	REQUIRE(st.empty());
+	REQUIRE_FALSE(st.min_addr().has_value());
+}
+
+TEMPLATE_TEST_CASE("test_storage_find_used", "", ExtentStorage, PagedStorage<>)
+{
+	TestType st;
+	st.set(10, 0);
+	st.set(20, 0);
+	REQUIRE_FALSE(st.find_used(0, 10).has_value());
+	REQUIRE(st.find_used(0, 11) == 10);
+	REQUIRE(st.find_used(10, 1) == 10);
+	REQUIRE(st.find_used(11, 100) == 20);
+	REQUIRE_FALSE(st.find_used(21, 100).has_value());
+}
+
+TEMPLATE_TEST_CASE("test_storage_runs_in_range", "", ExtentStorage, PagedStorage<>)
+{
+	TestType st;
+	vector<uint8_t> data(0x1800, 0);
+	st.write(0x800, data.data(), data.size());
+	st.set(0x3000, 0);
+	st.set(0xFFFFFFFF, 0);
+
+	auto runs_in = [&st](Addr first, Addr last)
+	{
+		Runs r;
+		st.for_each_run(first, last, [&r](Addr addr, const uint8_t *, size_t len)
+		{	r.push_back({addr, len});	});
+		return r;
+	};
+	REQUIRE(runs_in(0, 0x7FF).empty());
+	REQUIRE(runs_in(0x900, 0x1100) == Runs{ {0x900, 0x700}, {0x1000, 0x101} });
+	REQUIRE(runs_in(0x1FFF, 0x3000) == Runs{ {0x1FFF, 1}, {0x3000, 1} });
+	REQUIRE(runs_in(0x3001, 0xFFFFFFFE).empty());
+	REQUIRE(runs_in(0x3000, 0xFFFFFFFF) == Runs{ {0x3000, 1}, {0xFFFFFFFF, 1} });
+}
+
+TEMPLATE_TEST_CASE("test_storage_segments", "", ExtentStorage, PagedStorage<>)
+{
+	TestType st;
+	auto segments = [&st]()
+	{
+		Runs r;
+		st.for_each_segment([&r](Addr first, Addr last)
+		{	r.push_back({first, size_t(last - first) + 1});	});
+		REQUIRE(r.size() == st.segment_count());
+		return r;
+	};
+	vector<uint8_t> data(0x2000, 0);
+
+	st.write(0x800, data.data(), data.size());		// several blocks, one segment
+	st.set(0x3000, 0);
+	REQUIRE(segments() == Runs{ {0x800, 0x2000}, {0x3000, 1} });
+
+	st.write(0x2800, data.data(), 0x800);			// fills the gap
+	REQUIRE(segments() == Runs{ {0x800, 0x2801} });
+	st.write(0x1000, data.data(), 0x100);			// overwrite
+	REQUIRE(segments() == Runs{ {0x800, 0x2801} });
+
+	REQUIRE(st.erase(0x1000));						// split
+	REQUIRE(st.erase(0x800));						// first byte
+	REQUIRE(st.erase(0x3000));						// last byte
+	REQUIRE(segments() == Runs{ {0x801, 0x7FF}, {0x1001, 0x1FFF} });
+	REQUIRE(st.min_addr() == 0x801);
+	REQUIRE(st.max_addr() == 0x2FFF);
+
+	st.write(0xFFFFFFFE, data.data(), 4);			// wraps at 4G
+	REQUIRE(segments() == Runs{ {0, 2}, {0x801, 0x7FF}, {0x1001, 0x1FFF}, {0xFFFFFFFE, 2} });
+	REQUIRE(st.max_addr() == 0xFFFFFFFF);
+
+	st.clear();
+	REQUIRE(segments().empty());
+	REQUIRE_FALSE(st.max_addr().has_value());
+}
+
+TEMPLATE_TEST_CASE("test_storage_copy_on_write", "", ExtentStorage, PagedStorage<>)
+{
+	TestType base;
+	vector<uint8_t> data(0x3000, 0x55);
+	base.write(0x1000, data.data(), data.size());
+
+	// copies share data until modified
+	TestType a(base), b;
+	b = base;
+	REQUIRE(a.find(0x2000) == base.find(0x2000));
+
+	a.set(0x2000, 0xA1);
+	REQUIRE(a.find(0x2000) != base.find(0x2000));
+	REQUIRE(*a.find(0x2000) == 0xA1);
+	REQUIRE(*base.find(0x2000) == 0x55);
+	REQUIRE(*b.find(0x2000) == 0x55);
+	// untouched blocks are still shared
+	REQUIRE(a.find(0x1000) == base.find(0x1000));
+	REQUIRE(a.find(0x3FFF) == base.find(0x3FFF));
+
+	REQUIRE(b.erase(0x2001));
+	REQUIRE(b.size() == 0x2FFF);
+	REQUIRE(base.size() == 0x3000);
+	REQUIRE(*base.find(0x2001) == 0x55);
+
+	// modification of the original doesn't change copies
+	base.write(0x3FF0, data.data(), 0x20);
+	base.set(0x2000, 0xBA);
+	REQUIRE(*a.find(0x2000) == 0xA1);
+	REQUIRE(*b.find(0x2000) == 0x55);
+	REQUIRE(a.size() == 0x3000);
+	REQUIRE(a.max_addr() == 0x3FFF);
+	REQUIRE(base.max_addr() == 0x400F);
+}
+
+TEST_CASE("test_paged_storage_small_page")
+{
+	PagedStorage<64> st;
+	vector<uint8_t> data(200, 0xAA);
+	st.write(30, data.data(), data.size());
+	REQUIRE(st.size() == 200);
+	REQUIRE(runs(st) == Runs{ {30, 34}, {64, 64}, {128, 64}, {192, 38} });
+	REQUIRE(st.min_addr() == 30);
+	REQUIRE(st.max_addr() == 229);
+
+	// copy is independent
+	PagedStorage<64> copy(st);
+	REQUIRE(copy.erase(100));
+	REQUIRE(copy.size() == 199);
+	REQUIRE(st.size() == 200);
+	REQUIRE(*st.find(100) == 0xAA);
+
+	// emptied page is released
+	for (Addr a = 192; a < 230; a++)
+		REQUIRE(st.erase(a));
+	REQUIRE(st.max_addr() == 191);
+}
@@ -6,6 +6,27 @@
 using namespace std;
 
 
+TEST_CASE("test_write_hex_file_nonzero_base")
+{
+	// record length should not depend on the image start address
+	IntelHex ih;
+	for (IntelHex::Addr addr = 0x1000; addr < 0x1020; addr++)
+		ih.add(addr, uint8_t(addr));
+	for (IntelHex::Addr addr = 0x1030; addr < 0x1038; addr++)
+		ih.add(addr, uint8_t(addr));
+
+	stringstream sio;
+	ih.write_hex_file(sio, false);
+	REQUIRE(sio.str() ==
+		":10100000000102030405060708090A0B0C0D0E0F68\n"
+		":10101000101112131415161718191A1B1C1D1E1F58\n"
+		":0810300030313233343536371C\n"
+		":00000001FF\n");
+
+	IntelHex ih2(sio);
+	REQUIRE(ih.tobinarray() == ih2.tobinarray());
+}
+
 TEST_CASE("TestWriteHexFileByteCount")
 {
 	istringstream f(hex8);
@@ -79,3 +100,39 @@ TEST_CASE("TestWriteHexFileByteCount")
 	}
 
 }
+
+TEST_CASE("test_write_hex_file_fragmented")
+{
+	IntelHex ih;
+	// calibration table with 1-byte holes, across 64K boundary
+	for (IntelHex::Addr addr = 0xFFF8; addr < 0x10008; addr += 2)
+		ih.add(addr, uint8_t(addr));
+	// runs longer than byte_count with 1-byte holes
+	const uint8_t run[5] = { 1, 2, 3, 4, 5 };
+	for (IntelHex::Addr addr = 0x10100; addr < 0x10112; addr += 6)
+		ih.frombytes(run, sizeof(run), addr);
+
+	stringstream sio;
+	ih.write_hex_file(sio, false, 4);
+	REQUIRE(sio.str() ==
+		":020000040000FA\n"
+		":01FFF800F810\n"
+		":01FFFA00FA0C\n"
+		":01FFFC00FC08\n"
+		":01FFFE00FE04\n"
+		":020000040001F9\n"
+		":0100000000FF\n"
+		":0100020002FB\n"
+		":0100040004F7\n"
+		":0100060006F3\n"
+		":0401000001020304F1\n"
+		":0101040005F5\n"
+		":0401060001020304EB\n"
+		":01010A0005EF\n"
+		":04010C0001020304E5\n"
+		":0101100005E9\n"
+		":00000001FF\n");
+
+	IntelHex ih2(sio);
+	REQUIRE(ih.tobinarray() == ih2.tobinarray());
+}
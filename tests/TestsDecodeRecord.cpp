@@ -0,0 +1,261 @@
+#include <sstream>
+#include "../intelhex.h"
+#include "../intelhex_exception.h"
+#include "catch.hpp"
+#include "TestData.h"
+
+using namespace std;
+
+
+static IntelHex load(const string & hexstr)
+{
+	istringstream f(hexstr);
+	return IntelHex(f);
+}
+
+
+TEST_CASE("TestDecodeHexRecords")
+{
+	SECTION("test_empty_line")
+	{
+		// do we could to accept empty lines in hex files?
+		// standard don't say anything about this
+		REQUIRE_NOTHROW(load("\n\r\n:0100000001FE\n\n"));
+	}
+
+	SECTION("test_non_empty_line")
+	{
+		REQUIRE_THROWS_AS(load(" "), HexRecordError);
+	}
+
+	SECTION("test_short_record")
+	{
+		// if record too short it's not a hex record
+		REQUIRE_THROWS_AS(load(":"), HexRecordError);
+		REQUIRE_THROWS_AS(load(":00000001"), HexRecordError);
+	}
+
+	SECTION("test_odd_hexascii_digits")
+	{
+		REQUIRE_THROWS_AS(load(":0100000001FE0"), HexRecordError);
+	}
+
+	SECTION("test_non_hex_digits")
+	{
+		REQUIRE_THROWS_AS(load(":0100000001FG"), HexRecordError);
+		REQUIRE_THROWS_AS(load(":01000000 1FE"), HexRecordError);
+		REQUIRE_THROWS_AS(load(":01000000-1FE"), HexRecordError);
+	}
+
+	SECTION("test_lowercase_hex_digits")
+	{
+		IntelHex ih = load(":01000000ab54");
+		REQUIRE(ih[0] == 0xAB);
+	}
+
+	SECTION("test_invalid_length")
+	{
+		REQUIRE_THROWS_AS(load(":FF00000001"), RecordLengthError);
+		// longer than any possible record
+		REQUIRE_THROWS_AS(load(":00000000" + string(600, '0')), RecordLengthError);
+		REQUIRE_THROWS_AS(load(":00000000" + string(600, 'X')), HexRecordError);
+	}
+
+	SECTION("test_invalid_record_type")
+	{
+		REQUIRE_THROWS_AS(load(":000000FF01"), RecordTypeError);
+	}
+
+	SECTION("test_invalid_checksum")
+	{
+		REQUIRE_THROWS_AS(load(":0000000100"), RecordChecksumError);
+	}
+
+	SECTION("test_invalid_eof")
+	{
+		REQUIRE_THROWS_AS(load(":0100000100FE"), EOFRecordError);
+	}
+
+	SECTION("test_invalid_extended_segment")
+	{
+		// length
+		REQUIRE_THROWS_AS(load(":00000002FE"), ExtendedSegmentAddressRecordError);
+		REQUIRE_THROWS_AS(load(":0100000200FD"), ExtendedSegmentAddressRecordError);
+		// addr field
+		REQUIRE_THROWS_AS(load(":020001020000FB"), ExtendedSegmentAddressRecordError);
+	}
+
+	SECTION("test_invalid_linear_address")
+	{
+		// length
+		REQUIRE_THROWS_AS(load(":00000004FC"), ExtendedLinearAddressRecordError);
+		REQUIRE_THROWS_AS(load(":0100000400FB"), ExtendedLinearAddressRecordError);
+		// addr field
+		REQUIRE_THROWS_AS(load(":020001040000F9"), ExtendedLinearAddressRecordError);
+	}
+
+	SECTION("test_invalid_start_segment_addr")
+	{
+		// length
+		REQUIRE_THROWS_AS(load(":00000003FD"), StartSegmentAddressRecordError);
+		REQUIRE_THROWS_AS(load(":0100000300FC"), StartSegmentAddressRecordError);
+		// addr field
+		REQUIRE_THROWS_AS(load(":0400010300000000F8"), StartSegmentAddressRecordError);
+	}
+
+	SECTION("test_duplicate_start_segment_addr")
+	{
+		REQUIRE_THROWS_AS(load(":0400000312345678E5\n"
+							   ":0400000300000000F9\n"), DuplicateStartAddressRecordError);
+	}
+
+	SECTION("test_addr_overlap")
+	{
+		REQUIRE_THROWS_AS(load(":0100000000FF\n"
+							   ":0100000000FF\n"), AddressOverlapError);
+	}
+
+	SECTION("test_data_record")
+	{
+		IntelHex ih = load(":0100000000FF\n"
+						   ":020001000001FC\n"
+						   ":0400030003040506E7\n");
+		REQUIRE(ih.tobinarray() == IntelHex::BinArray{0, 0, 1, 3, 4, 5, 6});
+	}
+
+	SECTION("test_extended_segment_and_linear")
+	{
+		IntelHex ih = load(":020000021234B6\n"
+						   ":0100000001FE\n"
+						   ":020000040001F9\n"
+						   ":0100000002FD\n");
+		REQUIRE(ih[0x12340] == 1);
+		REQUIRE(ih[0x10000] == 2);
+		REQUIRE(ih.size() == 2);
+	}
+}
+
+TEST_CASE("test_try_loadhex")
+{
+	auto try_load = [](const string & hexstr)
+	{
+		istringstream f(hexstr);
+		IntelHex ih;
+		return ih.try_loadhex(f);
+	};
+
+	REQUIRE(try_load(":0100000001FE\n:00000001FF\n").ok());
+
+	HexResult res = try_load(":0100000001FE\n\n:0100000001FF\n");
+	REQUIRE(res.error == HexError::record_checksum);
+	REQUIRE(res.line == 3);
+	REQUIRE(res.offset == 15);
+
+	res = try_load(":0100000000FF\r\n:0100000000FF\r\n");
+	REQUIRE(res.error == HexError::address_overlap);
+	REQUIRE(res.line == 2);
+	REQUIRE(res.offset == 15);
+	REQUIRE(res.address == 0);
+
+	REQUIRE(try_load(":000000FF01").error == HexError::record_type);
+	REQUIRE(try_load(":00000004FC").error == HexError::extended_linear_address);
+	REQUIRE(try_load(":0400000312345678E5\n"
+					 ":0400000300000000F9\n").error == HexError::duplicate_start_address);
+
+	IntelHex ih;
+	REQUIRE(ih.try_loadhex("no such file.hex").error == HexError::io);
+	REQUIRE(ih.try_loadhex_mmap("no such file.hex").error == HexError::io);
+
+	// text in memory
+	res = ih.try_loadhex_text(":0100000001FE\n\n:0100000001FF\n");
+	REQUIRE(res.error == HexError::record_checksum);
+	REQUIRE(res.line == 3);
+	REQUIRE(res.offset == 15);
+	REQUIRE(ih[0] == 0x01);
+}
+
+TEST_CASE("test_exception_message")
+{
+	try {
+		load(":0100000000FF\n:020000040001F9\n:0100000000FF\n:0100000000FF\n");
+		FAIL();
+	}
+	catch (const std::exception & e) {
+		REQUIRE(string(e.what()) == "Hex file has data overlap at address 0x10000 on line 4");
+	}
+	try {
+		load(":0100000001FF");
+		FAIL();
+	}
+	catch (const IntelHexException & e) {
+		REQUIRE(string(e.what()) == "Record at line 1 has invalid checksum");
+	}
+}
+
+TEST_CASE("test_loadhex_lenient")
+{
+	const string text =
+		":020000000102FB\n"
+		":0100020003FB\n"			// bad checksum
+		":0100010009F5\n"			// overlap
+		"0100100005EA\n"			// no start code
+		":01001G0005EA\n"			// non-hex digit
+		":020000040001F9\n"
+		":0100100005EA\n"
+		":0400000500000001F6\n"
+		":0400000500000002F5\n"		// duplicate start address
+		":00000001FF\n";
+
+	auto check_diags = [](const vector<HexDiagnostic> & diags)
+	{
+		REQUIRE(diags.size() == 5);
+		REQUIRE(diags[0].error == HexError::record_checksum);
+		REQUIRE(diags[0].line == 2);
+		REQUIRE(diags[0].column == 12);
+		REQUIRE(diags[0].type == 0);
+		REQUIRE(diags[1].error == HexError::address_overlap);
+		REQUIRE(diags[1].line == 3);
+		REQUIRE(diags[1].column == 10);
+		REQUIRE(diags[1].address == 1);
+		REQUIRE(diags[2].error == HexError::hex_record);
+		REQUIRE(diags[2].line == 4);
+		REQUIRE(diags[2].column == 1);
+		REQUIRE(diags[2].type == HexDiagnostic::unknown_type);
+		REQUIRE(diags[3].error == HexError::hex_record);
+		REQUIRE(diags[3].line == 5);
+		REQUIRE(diags[3].column == 7);
+		REQUIRE(diags[4].error == HexError::duplicate_start_address);
+		REQUIRE(diags[4].line == 9);
+		REQUIRE(diags[4].type == 5);
+	};
+
+	SECTION("skip bad records")
+	{
+		istringstream f(text);
+		IntelHex ih;
+		check_diags(ih.loadhex_lenient(f));
+		REQUIRE(ih.size() == 3);
+		REQUIRE(ih[1] == 2);
+		REQUIRE(ih[0x10010] == 5);
+		REQUIRE(ih.start_addr == IntelHex::StartAddr(IntelHex::StartAddrExtended{ 1 }));
+	}
+
+	SECTION("apply bad records")
+	{
+		istringstream f(text);
+		IntelHex ih;
+		check_diags(ih.loadhex_lenient(f, IntelHex::LenientPolicy::apply));
+		REQUIRE(ih.size() == 4);
+		REQUIRE(ih[1] == 9);
+		REQUIRE(ih[2] == 3);
+		REQUIRE(ih.start_addr == IntelHex::StartAddr(IntelHex::StartAddrExtended{ 2 }));
+	}
+
+	SECTION("good file")
+	{
+		istringstream f(hex8);
+		IntelHex ih;
+		REQUIRE(ih.loadhex_lenient(f).empty());
+		REQUIRE(ih.size() == sizeof(bin8));
+	}
+}
@@ -97,6 +97,55 @@ TEST_CASE("test_tobinfile")
 
 }
 
+TEST_CASE("test_tobin_with_holes")
+{
+	IntelHex ih;
+	ih.padding = 0x5A;
+	const uint8_t data[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	ih.frombytes(data, 3, 0x0FFE);		// crosses 4K block boundary
+	ih.frombytes(data, 8, 0x1010);
+	ih.frombytes(data, 1, 0x2000);
+
+	// reference implementation: byte by byte
+	auto reference = [&](IntelHex::Addr start, IntelHex::Addr end)
+	{
+		IntelHex::BinArray arr;
+		for (auto a = start; a <= end; a++)
+			arr.push_back(ih[a]);
+		return arr;
+	};
+
+	REQUIRE(ih.tobinarray() == reference(0x0FFE, 0x2000));
+	REQUIRE(ih.tobinarray(0x0F00, 0x2100) == reference(0x0F00, 0x2100));
+	REQUIRE(ih.tobinarray(0x0FFF, 0x1012) == reference(0x0FFF, 0x1012));
+	REQUIRE(ih.tobinarray(0x1005, 0x100F) == reference(0x1005, 0x100F));
+
+	IntelHex::BinArray buffer(0x20, 0);
+	ih.tobinbuffer(0x1008, buffer.data(), buffer.size());
+	REQUIRE(buffer == reference(0x1008, 0x1027));
+
+	ostringstream sio;
+	ih.tobinfile(sio, 0x0F00, 0x2100);
+	const auto expected = reference(0x0F00, 0x2100);
+	REQUIRE(sio.str() == string((const char*)expected.data(), expected.size()));
+}
+
+TEST_CASE("test_tobin_across_4G")
+{
+	IntelHex ih;
+	ih.add(0xFFFFFFF8, 1);
+	ih.add(4, 2);
+
+	// range past 0xFFFFFFFF is padded, it doesn't wrap to address 0
+	auto expected = IntelHex::BinArray(0x10, ih.padding);
+	expected[0] = 1;
+	REQUIRE(ih.tobinarray(0xFFFFFFF8, {}, 0x10) == expected);
+
+	ostringstream sio;
+	ih.tobinfile(sio, 0xFFFFFFF8, {}, 0x10);
+	REQUIRE(sio.str() == string((const char*)expected.data(), expected.size()));
+}
+
 TEST_CASE("test_write_hexfile")
 {
 	istringstream stream(hex_simple);
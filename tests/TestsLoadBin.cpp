@@ -37,3 +37,30 @@ TEST_CASE("TestLoadBin")
 	}
 
 }
+
+TEST_CASE("test_frombytes_range")
+{
+	const uint8_t data[] = { 1, 2, 3, 4, 5 };
+	IntelHex ih{ {0x101, 0xAA}, {0x200, 0xBB} };
+	ih.frombytes(data, sizeof(data), 0x100);
+	REQUIRE(ih.size() == 6);
+	REQUIRE(ih.segments().size() == 2);
+	REQUIRE(ih.tobinarray(0x100, 0x104) == IntelHex::BinArray{1, 2, 3, 4, 5});
+	REQUIRE(ih[0x200] == 0xBB);
+}
+
+TEST_CASE("test_loadbin_big")
+{
+	// more than one read chunk
+	string bytes(1000000, 0);
+	for (size_t i = 0; i < bytes.size(); i++)
+		bytes[i] = char(i % 251);
+	istringstream f(bytes);
+	IntelHex ih;
+	ih.loadbin(f, 0x08000000);
+	REQUIRE(ih.size() == bytes.size());
+	REQUIRE(ih.segments().size() == 1);
+	REQUIRE(ih.minaddr() == 0x08000000);
+	auto arr = ih.tobinarray();
+	REQUIRE(string((char*)arr.data(), arr.size()) == bytes);
+}
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <system_error>
+#include "../intelhex.h"
+#include "../intelhex_exception.h"
+#include "catch.hpp"
+#include "TestData.h"
+
+using namespace std;
+
+
+TEST_CASE("test_loadhex_mmap")
+{
+	SECTION("same content as stream loader")
+	{
+		TempFile file(hex8);
+		IntelHex ih1;
+		ih1.loadhex_mmap(file.name);
+		istringstream f(hex8);
+		IntelHex ih2(f);
+		REQUIRE(ih1.tobinarray() == ih2.tobinarray());
+		REQUIRE(ih1.tobinarray() == IntelHex::BinArray(bin8, bin8 + size(bin8)));
+	}
+
+	SECTION("CRLF and no trailing newline")
+	{
+		TempFile file(":0100000001FE\r\n:0100010002FC");
+		IntelHex ih;
+		ih.loadhex_mmap(file.name);
+		REQUIRE(ih.tobinarray() == IntelHex::BinArray{1, 2});
+	}
+
+	SECTION("empty file")
+	{
+		TempFile file("");
+		IntelHex ih;
+		ih.loadhex_mmap(file.name);
+		REQUIRE(ih.size() == 0);
+	}
+
+	SECTION("errors")
+	{
+		TempFile file(":0100000001FE\n\n:0100000001FE\n");
+		IntelHex ih;
+		REQUIRE_THROWS_AS(ih.loadhex_mmap(file.name), AddressOverlapError);
+
+		REQUIRE_THROWS_AS(ih.loadhex_mmap(file.name + ".missing"), system_error);
+	}
+}
+
+TEST_CASE("test_loadhex_mmap_threads")
+{
+	// few MB of data in several 64K segments with holes, needs 04 records
+	IntelHex ih;
+	IntelHex::BinArray data(3 * 1024 * 1024);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = uint8_t(i * 7 + (i >> 12));
+	ih.frombytes(data, 0x8000);
+	for (IntelHex::Addr a = 0x10000; a < 0x20000; a += 0x1000)
+		ih.del(a);
+	ih.start_addr = IntelHex::StartAddrExtended{ 0x1234 };
+	ostringstream sio;
+	ih.write_hex_file(sio);
+	const string hex = sio.str();
+
+	SECTION("same result as sequential")
+	{
+		TempFile file(hex);
+		for (unsigned threads : { 0, 2, 3, 8 })
+		{
+			IntelHex ih2;
+			ih2.loadhex_mmap(file.name, threads);
+			REQUIRE(ih2.size() == ih.size());
+			REQUIRE(ih2.segments().size() == ih.segments().size());
+			REQUIRE(ih2.tobinarray() == ih.tobinarray());
+			REQUIRE(ih2.start_addr == ih.start_addr);
+		}
+	}
+
+	SECTION("error in the middle of file")
+	{
+		// broken checksum of the last data record
+		string bad = hex;
+		const auto pos = bad.rfind("\n:", bad.size() - 15);
+		const auto eol = bad.find('\n', pos + 1);
+		bad[eol - 1] = bad[eol - 1] == '0' ? '1' : '0';
+		TempFile file(bad);
+		IntelHex ih2;
+		REQUIRE_THROWS_AS(ih2.loadhex_mmap(file.name, 4), RecordChecksumError);
+
+		// error location is the same as with sequential decoding
+		const uint32_t line = uint32_t(count(bad.begin(), bad.begin() + pos, '\n')) + 2;
+		for (unsigned threads : { 1, 4 })
+		{
+			IntelHex ih3;
+			const HexResult res = ih3.try_loadhex_mmap(file.name, threads);
+			REQUIRE(res.error == HexError::record_checksum);
+			REQUIRE(res.line == line);
+			REQUIRE(res.offset == pos + 1);
+		}
+	}
+
+	SECTION("overlap between chunks")
+	{
+		// first data record repeated at the end of file
+		const auto first = hex.find("\n:10") + 1;
+		const auto eof = hex.rfind(":00000001FF");
+		string bad = hex.substr(0, eof) + ":020000040000FA\n"
+				   + hex.substr(first, hex.find('\n', first) + 1 - first) + hex.substr(eof);
+		TempFile file(bad);
+		IntelHex ih2;
+		REQUIRE_THROWS_AS(ih2.loadhex_mmap(file.name, 4), AddressOverlapError);
+		IntelHex ih3;
+		REQUIRE_THROWS_AS(ih3.loadhex_mmap(file.name, 1), AddressOverlapError);
+
+		const uint32_t lines = uint32_t(count(bad.begin(), bad.end(), '\n'));
+		IntelHex ih4;
+		const HexResult res = ih4.try_loadhex_mmap(file.name, 4);
+		REQUIRE(res.error == HexError::address_overlap);
+		REQUIRE(res.line == lines - 1);		// before EOF record
+		REQUIRE(res.address == ih.minaddr().value());
+		REQUIRE(res.offset == eof + 16);
+	}
+}
+
+TEST_CASE("test_loadbin_file")
+{
+	TempFile file(string((const char *)bin8, size(bin8)));
+	IntelHex ih;
+	ih.loadbin(file.name, 0x100);
+	REQUIRE(ih.minaddr() == 0x100);
+	REQUIRE(ih.tobinarray() == IntelHex::BinArray(bin8, bin8 + size(bin8)));
+
+	// missing file loads nothing, as with loadhex
+	ih.loadbin(file.name + ".missing", 0x10000);
+	REQUIRE(ih.tobinarray() == IntelHex::BinArray(bin8, bin8 + size(bin8)));
+}
+
+TEST_CASE("test_validate")
+{
+	// image with holes and start address
+	IntelHex ih;
+	IntelHex::BinArray data(0x30000, 0x55);
+	ih.frombytes(data, 0xF000);
+	ih.del(0x20000);
+	ih.start_addr = IntelHex::StartAddrSegmented{ 0x1234, 0x5678 };
+	ostringstream sio;
+	ih.write_hex_file(sio);
+	const string hex = sio.str();
+
+	auto check = [&ih](const IntelHex::Summary & sum)
+	{
+		REQUIRE(sum.result.ok());
+		REQUIRE(sum.data_bytes == ih.size());
+		REQUIRE(sum.data_records > 0);
+		const auto segments = ih.segments();
+		REQUIRE(sum.segments.size() == segments.size());
+		for (size_t i = 0; i < segments.size(); i++)
+		{
+			REQUIRE(sum.segments[i].begin == segments[i].begin);
+			REQUIRE(sum.segments[i].end == segments[i].end);
+		}
+		REQUIRE(sum.start_addr == ih.start_addr);
+	};
+
+	SECTION("stream")
+	{
+		istringstream stream(hex);
+		check(IntelHex::validate(stream));
+	}
+
+	SECTION("file")
+	{
+		TempFile file(hex);
+		check(IntelHex::validate(file.name));
+		REQUIRE(IntelHex::validate(file.name + ".missing").result.error == HexError::io);
+	}
+
+	SECTION("errors")
+	{
+		// the same checks as loadhex
+		istringstream overlap(":0100000000FF\n:0200FF000000FF\n:020000000400FA\n");
+		auto sum = IntelHex::validate(overlap);
+		REQUIRE(sum.result.error == HexError::address_overlap);
+		REQUIRE(sum.result.line == 3);
+		REQUIRE(sum.result.address == 0);
+		REQUIRE(sum.data_records == 2);
+
+		istringstream duplicate(":0400000312345678E5\n:0400000300000000F9\n");
+		REQUIRE(IntelHex::validate(duplicate).result.error == HexError::duplicate_start_address);
+
+		istringstream checksum(":0100000000FE\n");
+		REQUIRE(IntelHex::validate(checksum).result.error == HexError::record_checksum);
+	}
+}
+
+TEST_CASE("test_load_many")
+{
+	// small files, bad ones and a big one (memory-mapped)
+	vector<unique_ptr<TempFile>> files;
+	vector<string> names;
+	for (size_t i = 0; i < 20; i++)
+	{
+		IntelHex ih;
+		IntelHex::BinArray data(i == 7 ? 0x180000 : 16 * (i + 1), uint8_t(i));
+		ih.frombytes(data, 0x1000 * i);
+		ostringstream sio;
+		ih.write_hex_file(sio);
+		string hex = sio.str();
+		if (i % 5 == 3)
+			hex[1] = 'X';		// broken first record
+		files.push_back(make_unique<TempFile>(hex));
+		names.push_back(files.back()->name);
+	}
+	names.push_back(names[0] + ".missing");
+
+	for (unsigned threads : { 0, 1, 3 })
+	{
+		const auto results = IntelHex::load_many(names, threads);
+		REQUIRE(results.size() == names.size());
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			IntelHex expected;
+			const HexResult res = expected.try_loadhex(names[i]);
+			REQUIRE(results[i].result.error == res.error);
+			REQUIRE(results[i].result.line == res.line);
+			REQUIRE(results[i].image.size() == expected.size());
+			if (! expected.size())
+				continue;
+			REQUIRE(results[i].image.minaddr() == expected.minaddr());
+			REQUIRE(results[i].image.tobinarray() == expected.tobinarray());
+		}
+		REQUIRE(results.back().result.error == HexError::io);
+	}
+	REQUIRE(IntelHex::load_many({}).empty());
+}